@@ -0,0 +1,213 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#include <cerrno>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "batch.hpp"
+#include "checkcall.hpp"
+#include "test_api.h"
+#include "tracing.hpp"
+
+using namespace ::cppc;
+
+/**
+ * Every benchmark case describes a successful call to the mock API that is
+ * checked by one of the ReturnCheckPolicies, along with the hand-written C-style
+ * check we compare against.
+ */
+struct IsZeroCase {
+    using ReturnCheckPolicy = IsZeroReturnCheckPolicy;
+
+    static int argument() { return 0; }
+
+    static int function(int x) { return c_api_some_func_with_error_code(x, nullptr); }
+
+    static int raw(int x) {
+        const int rv = c_api_some_func_with_error_code(x, nullptr);
+        if (rv != 0) {
+            throw std::runtime_error("error");
+        }
+        return rv;
+    }
+};
+
+struct IsNotNegativeCase {
+    using ReturnCheckPolicy = IsNotNegativeReturnCheckPolicy;
+
+    static int argument() { return 1; }
+
+    static int function(int x) { return c_api_some_func_with_error_code(x, nullptr); }
+
+    static int raw(int x) {
+        const int rv = c_api_some_func_with_error_code(x, nullptr);
+        if (rv < 0) {
+            throw std::runtime_error("error");
+        }
+        return rv;
+    }
+};
+
+struct IsNotZeroCase {
+    using ReturnCheckPolicy = IsNotZeroReturnCheckPolicy;
+
+    static int argument() { return 1; }
+
+    static int function(int x) { return c_api_some_func_with_error_code(x, nullptr); }
+
+    static int raw(int x) {
+        const int rv = c_api_some_func_with_error_code(x, nullptr);
+        if (rv == 0) {
+            throw std::runtime_error("error");
+        }
+        return rv;
+    }
+};
+
+struct IsNotNullptrCase {
+    using ReturnCheckPolicy = IsNotNullptrReturnCheckPolicy;
+
+    static int *argument() {
+        static int value{0};
+        return &value;
+    }
+
+    static int *function(int *ptr) { return c_api_some_func_returning_pointer(ptr); }
+
+    static int *raw(int *ptr) {
+        int *rv = c_api_some_func_returning_pointer(ptr);
+        if (rv == nullptr) {
+            throw std::runtime_error("error");
+        }
+        return rv;
+    }
+};
+
+struct IsErrnoZeroCase {
+    using ReturnCheckPolicy = IsErrnoZeroReturnCheckPolicy;
+
+    static int argument() { return 0; }
+
+    static int function(int x) { return c_api_some_func_with_error_code(x, nullptr); }
+
+    static int raw(int x) {
+        errno = 0;
+        const int rv = c_api_some_func_with_error_code(x, nullptr);
+        if (errno != 0) {
+            throw std::runtime_error("error");
+        }
+        return rv;
+    }
+};
+
+template <class Case>
+void BM_RawCall(benchmark::State &state) {
+    auto argument = Case::argument();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(argument);
+        benchmark::DoNotOptimize(Case::raw(argument));
+    }
+}
+
+template <class Case>
+void BM_CallChecked(benchmark::State &state) {
+    auto argument = Case::argument();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(argument);
+        benchmark::DoNotOptimize(
+                callChecked<typename Case::ReturnCheckPolicy>(Case::function, argument));
+    }
+}
+
+template <class Case>
+void BM_CallGuard(benchmark::State &state) {
+    auto argument = Case::argument();
+    CallGuard<decltype(Case::function), typename Case::ReturnCheckPolicy> guard{Case::function};
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(argument);
+        benchmark::DoNotOptimize(guard(argument));
+    }
+}
+
+template <class Case>
+void BM_CallCheckContext(benchmark::State &state) {
+    using ct = CallCheckContext<typename Case::ReturnCheckPolicy>;
+    auto argument = Case::argument();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(argument);
+        benchmark::DoNotOptimize(ct::callChecked(Case::function, argument));
+    }
+}
+
+/**
+ * The cost of recording latency and outcome of every call (unless compiled
+ * with CPPC_NO_TRACING).
+ */
+template <class Case>
+void BM_TracingCallCheckContext(benchmark::State &state) {
+    using ct = TracingCallCheckContext<typename Case::ReturnCheckPolicy, DefaultErrorPolicy, Case>;
+    auto argument = Case::argument();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(argument);
+        benchmark::DoNotOptimize(ct::callChecked(Case::function, argument));
+    }
+}
+
+#define CPPC_CHECKCALL_BENCHMARKS(Case)             \
+    BENCHMARK_TEMPLATE(BM_RawCall, Case);           \
+    BENCHMARK_TEMPLATE(BM_CallChecked, Case);       \
+    BENCHMARK_TEMPLATE(BM_CallGuard, Case);         \
+    BENCHMARK_TEMPLATE(BM_CallCheckContext, Case);  \
+    BENCHMARK_TEMPLATE(BM_TracingCallCheckContext, Case)
+
+CPPC_CHECKCALL_BENCHMARKS(IsZeroCase);
+CPPC_CHECKCALL_BENCHMARKS(IsNotNegativeCase);
+CPPC_CHECKCALL_BENCHMARKS(IsNotZeroCase);
+CPPC_CHECKCALL_BENCHMARKS(IsNotNullptrCase);
+CPPC_CHECKCALL_BENCHMARKS(IsErrnoZeroCase);
+
+/**
+ * Issue state.range(0) successful calls, either one callChecked at a time or as
+ * a single batch.
+ */
+void BM_CallCheckedLoop(benchmark::State &state) {
+    const std::vector<std::tuple<int, int *>> arguments(state.range(0),
+                                                        std::make_tuple(1, nullptr));
+    for (auto _ : state) {
+        for (const auto &args : arguments) {
+            benchmark::DoNotOptimize(callChecked<IsNotNegativeReturnCheckPolicy>(
+                    c_api_some_func_with_error_code, std::get<0>(args), std::get<1>(args)));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_CallCheckedBatch(benchmark::State &state) {
+    const std::vector<std::tuple<int, int *>> arguments(state.range(0),
+                                                        std::make_tuple(1, nullptr));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(callCheckedBatch<IsNotNegativeReturnCheckPolicy>(
+                c_api_some_func_with_error_code, arguments));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_CallCheckedLoop)->Arg(16)->Arg(1024);
+BENCHMARK(BM_CallCheckedBatch)->Arg(16)->Arg(1024);
@@ -0,0 +1,249 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <random>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "checkcall.hpp"
+#include "retry.hpp"
+#include "test_api.h"
+
+using namespace ::cppc;
+
+/*
+ * Failure rates are given in tenths of a percent, i.e., 1 means 0.1%.
+ */
+static void failureRates(benchmark::internal::Benchmark *benchmark) {
+    for (int rate : {0, 1, 10, 100, 500}) {
+        benchmark->Arg(rate);
+    }
+}
+
+/**
+ * A fixed sequence of successes and failures with the given failure rate.
+ *
+ * The sequence is pseudo-random (but identical for every run), so that the
+ * branch predictor cannot learn it.
+ */
+static std::vector<bool> failurePattern(int rate) {
+    constexpr std::size_t patternLength{1 << 16};
+    std::mt19937 generator{42};
+    std::bernoulli_distribution failure{rate / 1000.0};
+    std::vector<bool> pattern(patternLength);
+    std::generate(pattern.begin(), pattern.end(), [&]() { return failure(generator); });
+    return pattern;
+}
+
+/**
+ * Records the latency of individual calls and reports throughput and
+ * percentiles as counters of the benchmark.
+ */
+class LatencyRecorder {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit LatencyRecorder(std::size_t capacity) { _samples.reserve(capacity); }
+
+    void record(Clock::time_point start, Clock::time_point end) {
+        if (_samples.size() < _samples.capacity()) {
+            _samples.push_back(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+        }
+    }
+
+    void report(benchmark::State &state) {
+        state.SetItemsProcessed(state.iterations());
+        std::sort(_samples.begin(), _samples.end());
+        state.counters["p50_ns"] = _percentile(0.5);
+        state.counters["p99_ns"] = _percentile(0.99);
+        state.counters["p999_ns"] = _percentile(0.999);
+        state.counters["max_ns"] = _samples.empty() ? 0.0 : _samples.back();
+    }
+
+private:
+    double _percentile(double p) const {
+        if (_samples.empty()) {
+            return 0.0;
+        }
+        return _samples[static_cast<std::size_t>(p * (_samples.size() - 1))];
+    }
+
+    std::vector<long long> _samples;
+};
+
+/**
+ * Runs the call of a benchmark case for every element of the failure pattern
+ * and catches whatever the ErrorPolicy throws.
+ */
+template <class Case>
+void BM_ErrorPath(benchmark::State &state) {
+    const auto pattern = failurePattern(static_cast<int>(state.range(0)));
+    LatencyRecorder recorder{1 << 20};
+    std::size_t i{0};
+    for (auto _ : state) {
+        const bool fail = pattern[i++ % pattern.size()];
+        const auto start = LatencyRecorder::Clock::now();
+        try {
+            benchmark::DoNotOptimize(Case::call(fail));
+        } catch (const std::exception &e) {
+            benchmark::DoNotOptimize(e.what());
+        }
+        recorder.record(start, LatencyRecorder::Clock::now());
+    }
+    recorder.report(state);
+}
+
+/*
+ * A function that fails the way most C functions do: it returns -1 and sets
+ * errno.
+ */
+static int failWithErrno(int x) {
+    const int rv = c_api_some_func_with_error_code(x, nullptr);
+    if (rv < 0) {
+        errno = EAGAIN;
+    }
+    return rv;
+}
+
+/**
+ * The baseline: C-style error handling that just hands the error code to the
+ * caller.
+ */
+struct RawCase {
+    static int call(bool fail) {
+        const int rv = c_api_some_func_with_error_code(fail ? -EAGAIN : 0, nullptr);
+        if (rv < 0) {
+            return -rv;
+        }
+        return 0;
+    }
+};
+
+struct ReportReturnValueCase {
+    static int call(bool fail) {
+        return callChecked<IsZeroReturnCheckPolicy, ReportReturnValueErrorPolicy>(
+                c_api_some_func_with_error_code, fail ? -EAGAIN : 0, nullptr);
+    }
+};
+
+struct ErrnoCase {
+    static int call(bool fail) {
+        return callChecked<IsNotNegativeReturnCheckPolicy, ErrnoErrorPolicy>(failWithErrno,
+                                                                             fail ? -1 : 0);
+    }
+};
+
+struct ErrorCodeCase {
+    static int call(bool fail) {
+        return callChecked<IsNotNegativeReturnCheckPolicy, ErrorCodeErrorPolicy>(
+                c_api_some_func_with_error_code, fail ? -EAGAIN : 0, nullptr);
+    }
+};
+
+struct ExpectedCase {
+    static int call(bool fail) {
+        return callChecked<IsNotNegativeReturnCheckPolicy,
+                           ExpectedErrorPolicy<NegatedReturnValueErrorSource>>(
+                       c_api_some_func_with_error_code, fail ? -EAGAIN : 0, nullptr)
+                .valueOr(-1);
+    }
+};
+
+/**
+ * Like GetProtoByNumberErrorPolicy in examples/getaddrinfo.cpp, substitutes a
+ * fallback value on error instead of throwing.
+ */
+struct SubstituteFallbackErrorPolicy {
+    static int fallback;
+
+    template <class Rv>
+    static int *handleError(const Rv &) {
+        return &fallback;
+    }
+
+    template <class Rv>
+    static int *handleOk(const Rv &rv) {
+        return rv;
+    }
+};
+
+int SubstituteFallbackErrorPolicy::fallback{0};
+
+struct SubstituteFallbackCase {
+    static int *call(bool fail) {
+        static int value{0};
+        return callChecked<IsNotNullptrReturnCheckPolicy, SubstituteFallbackErrorPolicy>(
+                c_api_some_func_returning_pointer, fail ? nullptr : &value);
+    }
+};
+
+/*
+ * Fails with EINTR if the call is to be interrupted (once), so that a retry
+ * succeeds.
+ */
+static int interruptOnce(bool *interrupted) {
+    const int rv = c_api_some_func_with_error_code(*interrupted ? -1 : 0, nullptr);
+    if (rv < 0) {
+        *interrupted = false;
+        errno = EINTR;
+    }
+    return rv;
+}
+
+/**
+ * Retrying an interrupted call by catching the exception thrown by the
+ * ErrorPolicy. Here, the failure rate is the rate of interrupted calls.
+ */
+struct CatchAndRetryCase {
+    static int call(bool fail) {
+        bool interrupted{fail};
+        while (true) {
+            try {
+                return callChecked<IsNotNegativeReturnCheckPolicy, ErrnoErrorPolicy>(interruptOnce,
+                                                                                     &interrupted);
+            } catch (const ErrnoError &e) {
+                if (e.code() != std::errc::interrupted) {
+                    throw;
+                }
+            }
+        }
+    }
+};
+
+struct RetryOnCase {
+    static int call(bool fail) {
+        bool interrupted{fail};
+        return RetryingCallCheckContext<RetryOn<EINTR>, IsNotNegativeReturnCheckPolicy,
+                                        ErrnoErrorPolicy>::callChecked(interruptOnce,
+                                                                       &interrupted);
+    }
+};
+
+BENCHMARK_TEMPLATE(BM_ErrorPath, RawCase)->Apply(failureRates);
+BENCHMARK_TEMPLATE(BM_ErrorPath, ReportReturnValueCase)->Apply(failureRates);
+BENCHMARK_TEMPLATE(BM_ErrorPath, ErrnoCase)->Apply(failureRates);
+BENCHMARK_TEMPLATE(BM_ErrorPath, ErrorCodeCase)->Apply(failureRates);
+BENCHMARK_TEMPLATE(BM_ErrorPath, ExpectedCase)->Apply(failureRates);
+BENCHMARK_TEMPLATE(BM_ErrorPath, SubstituteFallbackCase)->Apply(failureRates);
+BENCHMARK_TEMPLATE(BM_ErrorPath, CatchAndRetryCase)->Apply(failureRates);
+BENCHMARK_TEMPLATE(BM_ErrorPath, RetryOnCase)->Apply(failureRates);
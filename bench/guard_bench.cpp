@@ -0,0 +1,233 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "deferredfree.hpp"
+#include "guard.hpp"
+#include "resourcepool.hpp"
+#include "slab.hpp"
+#include "test_api.h"
+
+using namespace ::cppc;
+
+struct FreeResourceDeleter {
+    void operator()(int *ptr) const noexcept { c_api_free_resource(ptr); }
+};
+
+struct FreeResourceByReference {
+    void operator()(int &value) const noexcept { c_api_free_resource(&value); }
+};
+
+struct FreeResourceAndDelete {
+    void operator()(int *ptr) const noexcept {
+        c_api_free_resource(ptr);
+        delete ptr;
+    }
+};
+
+/**
+ * Every benchmark case creates a handle that releases an int (owned by
+ * somebody else) using c_api_free_resource.
+ */
+struct UniquePtrCase {
+    static auto create(int *ptr) { return std::unique_ptr<int, FreeResourceDeleter>{ptr}; }
+};
+
+struct GuardFreeFunctionCase {
+    using FreePolicy = FreeFunction<decltype(&c_api_free_resource), &c_api_free_resource>;
+
+    static auto create(int *ptr) { return Guard<int *, FreePolicy>{ptr}; }
+};
+
+struct GuardFunctionPointerCase {
+    static auto create(int *ptr) {
+        return Guard<int *, void (*)(int *)>{&c_api_free_resource, ptr};
+    }
+};
+
+struct GuardDefaultFreePolicyCase {
+    static auto create(int *ptr) { return Guard<int *>{FreeResourceDeleter{}, ptr}; }
+};
+
+/**
+ * These cases allocate the int on the heap, which is what UniquePointerStoragePolicy
+ * is for.
+ */
+struct UniquePtrAllocatingCase {
+    static auto create(int *) { return std::unique_ptr<int, FreeResourceAndDelete>{new int{}}; }
+};
+
+struct GuardUniquePointerStorageCase {
+    static auto create(int *) {
+        return Guard<int, FreeResourceByReference, UniquePointerStoragePolicy<int>>{};
+    }
+};
+
+struct GuardPooledStorageCase {
+    static auto create(int *) {
+        return Guard<int, FreeResourceByReference, PooledStoragePolicy<int>>{};
+    }
+};
+
+/**
+ * Recycles the heap-allocated ints of UniquePtrAllocatingCase instead of
+ * allocating and freeing one per iteration.
+ */
+struct NewInt {
+    int *operator()() const { return new int{}; }
+};
+
+struct DeleteInt {
+    void operator()(int *ptr) const noexcept { delete ptr; }
+};
+
+struct ResourcePoolCase {
+    using Pool = ResourcePool<int *, NewInt, FreeResourceDeleter, DeleteInt>;
+
+    static auto create(int *) { return Pool::instance().acquire(); }
+};
+
+/**
+ * Stands in for an expensive free routine, such as freeaddrinfo on a long
+ * list or RSA_free. With DeferredFree, it runs on the background thread
+ * instead of the benchmark thread.
+ */
+void expensive_free(int *ptr) noexcept {
+    for (int i = 0; i < 256; i++) {
+        benchmark::DoNotOptimize(*ptr);
+        benchmark::ClobberMemory();
+    }
+}
+
+struct GuardExpensiveFreeCase {
+    using FreePolicy = FreeFunction<decltype(&expensive_free), &expensive_free>;
+
+    static auto create(int *ptr) { return Guard<int *, FreePolicy>{ptr}; }
+};
+
+struct GuardDeferredFreeCase {
+    static auto create(int *ptr) {
+        return Guard<int *, DeferredFree<GuardExpensiveFreeCase::FreePolicy>>{ptr};
+    }
+};
+
+template <class Case>
+void BM_ConstructDestroy(benchmark::State &state) {
+    int value{0};
+    for (auto _ : state) {
+        auto handle = Case::create(&value);
+        benchmark::DoNotOptimize(handle);
+    }
+}
+
+template <class Case>
+void BM_ConstructMoveDestroy(benchmark::State &state) {
+    int value{0};
+    for (auto _ : state) {
+        auto handle = Case::create(&value);
+        benchmark::DoNotOptimize(handle);
+        auto moved = std::move(handle);
+        benchmark::DoNotOptimize(moved);
+    }
+}
+
+/**
+ * Keeps state.range(0) handles alive and replaces one of them per iteration,
+ * so that handles are destroyed in a different order than they were created.
+ */
+template <class Case>
+void BM_CreateDestroyChurn(benchmark::State &state) {
+    int value{0};
+    const auto numLive = static_cast<std::size_t>(state.range(0));
+    std::vector<decltype(Case::create(&value))> handles{};
+    for (std::size_t i = 0; i < numLive; i++) {
+        handles.push_back(Case::create(&value));
+    }
+    std::size_t next{0};
+    for (auto _ : state) {
+        handles[next] = Case::create(&value);
+        benchmark::DoNotOptimize(handles[next]);
+        next = (next + 997) % numLive;
+    }
+}
+
+/**
+ * Destroys state.range(0) Guards that free heap memory, as static and
+ * long-lived Guards are destroyed at process exit, with or without fast exit.
+ */
+template <bool fastExit>
+void BM_Teardown(benchmark::State &state) {
+    using TeardownGuard = Guard<int *, OnlyFreesMemoryPolicy<DeleteInt>>;
+    std::vector<int *> values(static_cast<std::size_t>(state.range(0)));
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::vector<TeardownGuard> guards{};
+        guards.reserve(values.size());
+        for (auto &value : values) {
+            value = new int{};
+            guards.emplace_back(value);
+        }
+        if (fastExit) {
+            beginFastExit();
+        }
+        state.ResumeTiming();
+        guards.clear();
+        state.PauseTiming();
+        if (fastExit) {
+            // the process does not exit, so reset the flag and clean up after it
+            _auxiliary::fastExitFlag().store(false, std::memory_order_relaxed);
+            for (int *value : values) {
+                delete value;
+            }
+        }
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+#define CPPC_GUARD_BENCHMARKS(Case)                  \
+    BENCHMARK_TEMPLATE(BM_ConstructDestroy, Case);   \
+    BENCHMARK_TEMPLATE(BM_ConstructMoveDestroy, Case)
+
+CPPC_GUARD_BENCHMARKS(UniquePtrCase);
+CPPC_GUARD_BENCHMARKS(GuardFreeFunctionCase);
+CPPC_GUARD_BENCHMARKS(GuardFunctionPointerCase);
+CPPC_GUARD_BENCHMARKS(GuardDefaultFreePolicyCase);
+CPPC_GUARD_BENCHMARKS(UniquePtrAllocatingCase);
+CPPC_GUARD_BENCHMARKS(GuardUniquePointerStorageCase);
+CPPC_GUARD_BENCHMARKS(GuardPooledStorageCase);
+CPPC_GUARD_BENCHMARKS(ResourcePoolCase);
+
+BENCHMARK_TEMPLATE(BM_Teardown, false)->Arg(1 << 16)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(BM_Teardown, true)->Arg(1 << 16)->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_TEMPLATE(BM_ConstructDestroy, GuardExpensiveFreeCase);
+BENCHMARK_TEMPLATE(BM_ConstructDestroy, GuardDeferredFreeCase);
+
+BENCHMARK_TEMPLATE(BM_CreateDestroyChurn, UniquePtrAllocatingCase)->Arg(1)->Arg(64)->Arg(4096);
+BENCHMARK_TEMPLATE(BM_CreateDestroyChurn, GuardUniquePointerStorageCase)
+        ->Arg(1)
+        ->Arg(64)
+        ->Arg(4096);
+BENCHMARK_TEMPLATE(BM_CreateDestroyChurn, GuardPooledStorageCase)->Arg(1)->Arg(64)->Arg(4096);
+BENCHMARK_TEMPLATE(BM_CreateDestroyChurn, ResourcePoolCase)->Arg(1)->Arg(64)->Arg(4096);
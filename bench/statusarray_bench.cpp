@@ -0,0 +1,55 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "statusarray.hpp"
+
+using namespace ::cppc;
+
+/**
+ * Scan state.range(0) successful status codes, either with a plain loop or
+ * with the (vectorized) status array checks.
+ */
+template <class T>
+void BM_ScalarAllNotNegative(benchmark::State &state) {
+    const std::vector<T> statuses(state.range(0), 1);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(statuses.data());
+        benchmark::DoNotOptimize(std::all_of(statuses.begin(), statuses.end(),
+                                             [](T status) { return status >= 0; }));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+template <class T>
+void BM_AllNotNegative(benchmark::State &state) {
+    const std::vector<T> statuses(state.range(0), 1);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(statuses.data());
+        benchmark::DoNotOptimize(
+                AllNotNegativeReturnCheckPolicy::returnValueIsOk(StatusArray<T>{statuses}));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK_TEMPLATE(BM_ScalarAllNotNegative, int)->Arg(64)->Arg(4096);
+BENCHMARK_TEMPLATE(BM_AllNotNegative, int)->Arg(64)->Arg(4096);
+BENCHMARK_TEMPLATE(BM_ScalarAllNotNegative, long)->Arg(64)->Arg(4096);
+BENCHMARK_TEMPLATE(BM_AllNotNegative, long)->Arg(64)->Arg(4096);
@@ -17,12 +17,14 @@
 #include <iostream>
 #include "checkcall.hpp"
 #include "guard.hpp"
+#include "resourcepool.hpp"
 
 #include "boost/format.hpp"
 
 extern "C" {
 #include "openssl/bn.h"
 #include "openssl/err.h"
+#include "openssl/evp.h"
 #include "openssl/rand.h"
 #include "openssl/rsa.h"
 }
@@ -151,4 +153,64 @@ int rsaKeygenCPPCWay() {
     return 0;
 }
 
-int main() { return rsaKeygenCPPCWay(); }
+/*
+ * When generating many keys, the exponent can be leased from a pool instead of
+ * creating and freeing a BIGNUM for every key. This variant uses the EVP API
+ * of OpenSSL 3.
+ */
+struct BNCreate {
+    BIGNUM *operator()() const { return ct_ptr::callChecked(BN_new); }
+};
+
+struct BNClear {
+    void operator()(BIGNUM *bn) const noexcept { BN_clear(bn); }
+};
+
+struct BNFree {
+    void operator()(BIGNUM *bn) const noexcept { BN_free(bn); }
+};
+
+using BNPool = cppc::ResourcePool<BIGNUM *, BNCreate, BNClear, BNFree>;
+
+struct EVPKeyCtxDeleter {
+    void operator()(EVP_PKEY_CTX *ctx) const { EVP_PKEY_CTX_free(ctx); }
+};
+
+struct EVPKeyDeleter {
+    void operator()(EVP_PKEY *key) const { EVP_PKEY_free(key); }
+};
+
+using EVPKeyCtxGuard = cppc::Guard<EVP_PKEY_CTX *, EVPKeyCtxDeleter>;
+using EVPKeyGuard = cppc::Guard<EVP_PKEY *, EVPKeyDeleter>;
+
+// EVP functions return 0 or a negative value to indicate error
+struct IsPositiveReturnCheckPolicy {
+    template <class Rv>
+    static inline bool returnValueIsOk(const Rv &rv) {
+        return rv > 0;
+    }
+};
+
+using ct_evp = cppc::CallCheckContext<IsPositiveReturnCheckPolicy, OpenSSLErrorPolicy>;
+
+int rsaKeygenPooledExponent() {
+    ct::callChecked(RAND_status);
+    EVPKeyCtxGuard ctx{ct_ptr::callChecked(EVP_PKEY_CTX_new_id, EVP_PKEY_RSA, nullptr)};
+    ct_evp::callChecked(EVP_PKEY_keygen_init, ctx.get());
+    ct_evp::callChecked(EVP_PKEY_CTX_set_rsa_keygen_bits, ctx.get(), 2048);
+    {
+        auto exponent = BNPool::instance().acquire();
+        ct::callChecked(BN_set_word, exponent.get(), 65537);
+        // copies the exponent, so it goes back to the pool right away
+        ct_evp::callChecked(EVP_PKEY_CTX_set1_rsa_keygen_pubexp, ctx.get(), exponent.get());
+    }
+    EVPKeyGuard key{nullptr};
+    ct_evp::callChecked(EVP_PKEY_keygen, ctx.get(), &key.get());
+    ct_evp::callChecked(EVP_PKEY_print_private_fp, stdout, key.get(), INDENT, nullptr);
+    return 0;
+}
+
+int main(int argc, char *[]) {
+    // pass any argument to generate the key with an exponent from the pool
+    return argc > 1 ? rsaKeygenPooledExponent() : rsaKeygenCPPCWay();
+}
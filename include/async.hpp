@@ -0,0 +1,51 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+
+#pragma once
+
+#include <tuple>
+#include <utility>
+
+#include "checkcall.hpp"
+#include "executor.hpp"
+
+namespace cppc {
+
+/**
+ * @brief Run a checked call on an Executor.
+ *
+ * The callable and the arguments are copied (or moved) into the task, as with
+ * std::thread; use std::ref to pass references. The returned CallFuture yields
+ * the policy-handled return value, or rethrows the exception thrown by the
+ * ErrorPolicy. It waits for the call to complete when destroyed, so
+ * out-parameters only need to outlive the CallFuture.
+ */
+template <class R = DefaultReturnCheckPolicy,
+          class E = DefaultErrorPolicy,
+          class Callable,
+          class... Args>
+inline auto callCheckedAsync(Executor& executor, Callable&& callable, Args&&... args) {
+    return executor.submit([callable = std::forward<Callable>(callable),
+                            args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+        auto call = [&callable](auto&&... a) {
+            return callChecked<R, E>(callable, std::forward<decltype(a)>(a)...);
+        };
+        return _auxiliary::apply(call, std::move(args));
+    });
+}
+
+}  // namespace cppc
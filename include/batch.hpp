@@ -0,0 +1,165 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "checkcall.hpp"
+
+namespace cppc {
+
+/**
+ * @brief A failed call in a batch: its position in the batch, its return value and the value
+ * of errno right after the call.
+ */
+template <class Rv>
+struct BatchFailure {
+    std::size_t index;
+    Rv returnValue;
+    int error;
+};
+
+/**
+ * @brief The outcome of a batch of checked calls (see callCheckedBatch).
+ *
+ * Only the failed calls are recorded, so a batch without failures does not
+ * allocate.
+ */
+template <class Rv>
+class BatchResult {
+public:
+    using ReturnType = Rv;
+
+    bool ok() const noexcept { return _failures.empty(); }
+
+    /**
+     * The number of calls in the batch.
+     */
+    std::size_t size() const noexcept { return _size; }
+
+    const std::vector<BatchFailure<Rv>>& failures() const noexcept { return _failures; }
+
+private:
+    template <class R, class E, class Callable, class Range>
+    friend auto callCheckedBatch(Callable&& callable, Range&& range);
+
+    std::size_t _size{0};
+    std::vector<BatchFailure<Rv>> _failures{};
+};
+
+namespace _auxiliary {
+
+struct BatchReturnCheckPolicy {
+    template <class Rv>
+    static inline bool returnValueIsOk(const BatchResult<Rv>& result) noexcept {
+        return result.ok();
+    }
+};
+
+struct ErrnoBatchErrorPolicy {
+    template <class Rv>
+    static void handleError(const BatchResult<Rv>& result) {
+        throw ErrnoError{result.failures().front().error};
+    }
+};
+
+struct ErrorCodeBatchErrorPolicy {
+    template <class Rv>
+    static void handleError(const BatchResult<Rv>& result) {
+        static_assert(std::is_integral<Rv>::value, "Must be an integral value");
+        throw ErrnoError{static_cast<int>(-result.failures().front().returnValue)};
+    }
+};
+
+}  // namespace _auxiliary
+
+/**
+ * @brief The ErrorPolicy that callCheckedBatch uses for a failed batch, given
+ * the ErrorPolicy of a single call.
+ *
+ * By default, the ErrorPolicy itself receives the BatchResult. ErrnoErrorPolicy
+ * and ErrorCodeErrorPolicy throw the error of the first failed call instead.
+ * Specialize this to make other ErrorPolicies usable in batches.
+ */
+template <class ErrorPolicy>
+struct BatchErrorPolicy {
+    using type = ErrorPolicy;
+};
+
+template <>
+struct BatchErrorPolicy<ErrnoErrorPolicy> {
+    using type = _auxiliary::ErrnoBatchErrorPolicy;
+};
+
+template <>
+struct BatchErrorPolicy<ErrorCodeErrorPolicy> {
+    using type = _auxiliary::ErrorCodeBatchErrorPolicy;
+};
+
+/**
+ * @brief Call a function once for every tuple of arguments in a range and check all return
+ * values.
+ *
+ * Unlike calling callChecked in a loop, a failed call does not invoke the
+ * ErrorPolicy right away. Instead, the index, return value and errno of every
+ * failed call are recorded and the batch continues. Once the batch is complete, and
+ * if any call failed, the ErrorPolicy is called once with the BatchResult. So
+ * the loop itself never throws and the branch on the ReturnCheckPolicy is
+ * easily predicted.
+ *
+ *  std::vector<std::tuple<int, int, int, const void *, socklen_t>> options{...};
+ *  callCheckedBatch<IsZeroReturnCheckPolicy, ErrnoErrorPolicy>(setsockopt, options);
+ *
+ * The ErrorPolicy must accept a BatchResult (see BatchErrorPolicy).
+ * ErrnoErrorPolicy and ErrorCodeErrorPolicy throw the error of the first
+ * failed call. If the ErrorPolicy does not throw, the BatchResult is returned. ErrorPolicies
+ * that modify the return value receive the BatchResult as an rvalue (in
+ * handleError as well as in handleOk) and their return value is returned
+ * instead.
+ */
+template <class R = DefaultReturnCheckPolicy,
+          class E = DefaultErrorPolicy,
+          class Callable,
+          class Range>
+inline auto callCheckedBatch(Callable&& callable, Range&& range) {
+    using std::begin;
+    using Rv = std::decay_t<decltype(_auxiliary::apply(callable, *begin(range)))>;
+    auto runBatch = [&]() {
+        BatchResult<Rv> result{};
+        for (auto&& args : range) {
+            _auxiliary::callPrecCallIfPresent<R>();
+            auto rv = _auxiliary::apply(callable, std::forward<decltype(args)>(args));
+            if (!R::returnValueIsOk(rv)) {
+                // read errno before recording the failure (which may allocate) changes it
+                const int error{errno};
+                result._failures.push_back(BatchFailure<Rv>{result._size, std::move(rv), error});
+            }
+            ++result._size;
+        }
+        return result;
+    };
+    return _auxiliary::ReturnCheckWrapper<_auxiliary::BatchReturnCheckPolicy,
+                                          typename BatchErrorPolicy<E>::type,
+                                          BatchResult<Rv>>::callAndHandleReturnValue(runBatch);
+}
+
+}  // namespace cppc
@@ -0,0 +1,172 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+namespace cppc {
+
+/**
+ * @brief A fixed-capacity, lock-free queue for many producers and one or many consumers.
+ *
+ * Every slot carries a sequence number that tells producers whether the slot
+ * is free and consumers whether it has been written (see Dmitry Vyukov's
+ * bounded MPMC queue). Producers claim a slot with a single compare-and-swap
+ * and never wait for each other. If the queue is full, tryPush() fails instead
+ * of blocking, so that the caller can decide how to apply backpressure.
+ *
+ * Unless multipleConsumers is set, tryPop() must not be called concurrently
+ * (e.g., only from a dedicated thread or under a mutex), which saves the
+ * compare-and-swap on the consumer side. Use the aliases BoundedMpscQueue and
+ * BoundedMpmcQueue.
+ */
+template <class T, std::size_t capacity, bool multipleConsumers>
+class BoundedQueue {
+    static_assert(capacity >= 2 && (capacity & (capacity - 1)) == 0,
+                  "Capacity must be a power of two");
+    static_assert(std::is_nothrow_move_assignable<T>::value &&
+                          std::is_default_constructible<T>::value,
+                  "Elements must be default-constructible and nothrow move-assignable");
+
+public:
+    BoundedQueue() noexcept {
+        for (std::size_t i = 0; i < capacity; i++) {
+            _slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedQueue(const BoundedQueue &) = delete;
+    BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+    /**
+     * Append a value. Returns false (and leaves the value untouched) if the
+     * queue is full.
+     */
+    bool tryPush(T &value) noexcept {
+        std::size_t position{_tail.load(std::memory_order_relaxed)};
+        while (true) {
+            _Slot &slot{_slots[position & _MASK]};
+            const std::size_t sequence{slot.sequence.load(std::memory_order_acquire)};
+            const auto difference = static_cast<std::ptrdiff_t>(sequence - position);
+            if (difference == 0) {
+                if (_tail.compare_exchange_weak(position, position + 1,
+                                                std::memory_order_relaxed)) {
+                    slot.value = std::move(value);
+                    slot.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = _tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool tryPush(T &&value) noexcept { return tryPush(value); }
+
+    /**
+     * Remove the oldest value. Returns false if the queue is empty (or the
+     * oldest value is still being written).
+     */
+    bool tryPop(T &value) noexcept { return _tryPop(value, _MultipleConsumers{}); }
+
+    /**
+     * The number of values in the queue. Only exact if there are no concurrent
+     * pushes or pops.
+     */
+    std::size_t size() const noexcept {
+        const std::size_t head{_head.load(std::memory_order_relaxed)};
+        const std::size_t tail{_tail.load(std::memory_order_relaxed)};
+        return tail > head ? tail - head : 0;
+    }
+
+    static constexpr std::size_t maxSize() noexcept { return capacity; }
+
+private:
+    using _MultipleConsumers = std::integral_constant<bool, multipleConsumers>;
+
+    bool _tryPop(T &value, std::false_type) noexcept {
+        const std::size_t head{_head.load(std::memory_order_relaxed)};
+        _Slot &slot{_slots[head & _MASK]};
+        if (slot.sequence.load(std::memory_order_acquire) != head + 1) {
+            return false;
+        }
+        value = std::move(slot.value);
+        slot.sequence.store(head + capacity, std::memory_order_release);
+        _head.store(head + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool _tryPop(T &value, std::true_type) noexcept {
+        std::size_t position{_head.load(std::memory_order_relaxed)};
+        while (true) {
+            _Slot &slot{_slots[position & _MASK]};
+            const std::size_t sequence{slot.sequence.load(std::memory_order_acquire)};
+            const auto difference = static_cast<std::ptrdiff_t>(sequence - (position + 1));
+            if (difference == 0) {
+                if (_head.compare_exchange_weak(position, position + 1,
+                                                std::memory_order_relaxed)) {
+                    value = std::move(slot.value);
+                    slot.sequence.store(position + capacity, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = _head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    static constexpr std::size_t _MASK{capacity - 1};
+    static constexpr std::size_t _CACHE_LINE{64};
+
+    // Keeps producers and consumers from sharing cache lines. Padding
+    // instead of alignas, so that queues can be created with operator new
+    // before C++17.
+    using _Padding = char[_CACHE_LINE - sizeof(std::atomic<std::size_t>)];
+
+    struct _Slot {
+        std::atomic<std::size_t> sequence;
+        T value{};
+    };
+
+    std::atomic<std::size_t> _tail{0};
+    _Padding _tailPadding;
+    std::atomic<std::size_t> _head{0};
+    _Padding _headPadding;
+    _Slot _slots[capacity];
+};
+
+#if __cplusplus < 201703L
+template <class T, std::size_t capacity, bool multipleConsumers>
+constexpr std::size_t BoundedQueue<T, capacity, multipleConsumers>::_MASK;
+template <class T, std::size_t capacity, bool multipleConsumers>
+constexpr std::size_t BoundedQueue<T, capacity, multipleConsumers>::_CACHE_LINE;
+#endif
+
+template <class T, std::size_t capacity>
+using BoundedMpscQueue = BoundedQueue<T, capacity, false>;
+
+template <class T, std::size_t capacity>
+using BoundedMpmcQueue = BoundedQueue<T, capacity, true>;
+
+}  // namespace cppc
@@ -17,14 +17,19 @@
 #pragma once
 
 #include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
 #include <cstring>
 #include <functional>
-#include <sstream>
 #include <stdexcept>
+#include <system_error>
+#include <tuple>
 #include <type_traits>
 #include <utility>
 
-#include "boost/format.hpp"
+#include "probes.hpp"
+#include "result.hpp"
 
 namespace cppc {
 
@@ -56,18 +61,42 @@ struct _VoidT {
 template <class... Ts>
 using VoidT = typename _VoidT<Ts...>::type;
 
+/**
+ * C++14 replacement for std::apply.
+ */
+template <class Callable, class Tuple, std::size_t... Is>
+inline decltype(auto) applyImpl(Callable& callable, Tuple&& tuple, std::index_sequence<Is...>) {
+    return callable(std::get<Is>(std::forward<Tuple>(tuple))...);
+}
+
+template <class Callable, class Tuple>
+inline decltype(auto) apply(Callable& callable, Tuple&& tuple) {
+    return applyImpl(callable, std::forward<Tuple>(tuple),
+                     std::make_index_sequence<std::tuple_size<std::decay_t<Tuple>>::value>{});
+}
+
 /**
  * Helper template to wrap the handling of error conditions and return codes.
  * This is necessary to obtain a correct return value (in case of
  * return-value-modifying ErrorPolicies) without complication to
  * function-template 'callChecked' (defined below).
+ *
+ * The return value of the callable is never copied: It is constructed in
+ * place and returned via (named) return value optimization or, if the
+ * compiler does not elide the copy, moved. Thus, large structs are returned
+ * without copies and move-only types can be returned at all.
  */
 template <class ReturnCheckPolicy, class ErrorPolicy, class Rv, class = VoidT<>>
 struct ReturnCheckWrapper {
-    template <class R>
-    inline static Rv policyHandeledReturnValue(const R& rv) {
+    template <class Callable, class... Args>
+    inline static Rv callAndHandleReturnValue(Callable& callable, Args&&... args) {
+        CPPC_PROBE1(call_entry, probeFunction(callable));
+        Rv rv = callable(std::forward<Args>(args)...);
         if (!ReturnCheckPolicy::returnValueIsOk(rv)) {
+            CPPC_PROBE1(call_fail, probeValue(rv));
             ErrorPolicy::handleError(rv);
+        } else {
+            CPPC_PROBE1(call_ok, probeValue(rv));
         }
         return rv;
     }
@@ -77,24 +106,135 @@ struct ReturnCheckWrapper {
  * Template specialization that handles the case where an ErrorPolicy modifies
  * the returnValue. This is recognized by inspecting the 'handleOk' function, its
  * type and the return value of both 'handleOk' and 'handleError' (they must
- * match).
+ * match). The return value is moved into 'handleOk' or 'handleError'.
  */
 template <class ReturnCheckPolicy, class ErrorPolicy, class Rv>
 struct ReturnCheckWrapper<ReturnCheckPolicy,
                           ErrorPolicy,
                           Rv,
                           VoidT<decltype(ErrorPolicy::handleOk(std::declval<Rv>()))>> {
-    template <class R>
-    inline static auto policyHandeledReturnValue(const R& rv) {
+    template <class Callable, class... Args>
+    inline static auto callAndHandleReturnValue(Callable& callable, Args&&... args) {
+        CPPC_PROBE1(call_entry, probeFunction(callable));
+        Rv rv = callable(std::forward<Args>(args)...);
         if (!ReturnCheckPolicy::returnValueIsOk(rv)) {
-            return ErrorPolicy::handleError(rv);
+            CPPC_PROBE1(call_fail, probeValue(rv));
+            return ErrorPolicy::handleError(std::move(rv));
         }
-        return ErrorPolicy::handleOk(rv);
+        CPPC_PROBE1(call_ok, probeValue(rv));
+        return ErrorPolicy::handleOk(std::move(rv));
     }
 };
 
 }  // ::_auxiliary
 
+/**
+ * @brief Exception reporting the return value of a failed call.
+ *
+ * The exception only stores the return value. The message is formatted into a
+ * buffer inside the exception object when what() is first called. Hence,
+ * constructing and throwing the exception does not allocate any memory (other
+ * than the exception object itself, which is allocated by the C++ runtime).
+ *
+ * Integral, enum, floating-point and pointer values are part of the message.
+ * Values of other types are not.
+ *
+ * Since the message is formatted lazily, what() must not be called on the same
+ * object from different threads concurrently.
+ */
+class ReturnValueError : public std::runtime_error {
+public:
+    template <class Rv>
+    explicit ReturnValueError(const Rv& rv) : std::runtime_error{""} {
+        _store(rv);
+    }
+
+    const char* what() const noexcept override;
+
+private:
+    enum class _Kind : unsigned char { NONE, SIGNED, UNSIGNED, FLOATING, POINTER };
+
+    template <class Rv,
+              std::enable_if_t<std::is_integral<Rv>::value && std::is_signed<Rv>::value, int> = 0>
+    void _store(Rv rv) noexcept {
+        _kind = _Kind::SIGNED;
+        _value.signedValue = rv;
+    }
+
+    template <class Rv,
+              std::enable_if_t<std::is_integral<Rv>::value && std::is_unsigned<Rv>::value, int> =
+                      0>
+    void _store(Rv rv) noexcept {
+        _kind = _Kind::UNSIGNED;
+        _value.unsignedValue = rv;
+    }
+
+    template <class Rv, std::enable_if_t<std::is_enum<Rv>::value, int> = 0>
+    void _store(Rv rv) noexcept {
+        _store(static_cast<std::underlying_type_t<Rv>>(rv));
+    }
+
+    template <class Rv, std::enable_if_t<std::is_floating_point<Rv>::value, int> = 0>
+    void _store(Rv rv) noexcept {
+        _kind = _Kind::FLOATING;
+        _value.floatingValue = rv;
+    }
+
+    template <class Rv>
+    using _IsObjectPointer =
+            std::integral_constant<bool,
+                                   (std::is_pointer<Rv>::value &&
+                                    std::is_object<std::remove_pointer_t<Rv>>::value) ||
+                                           std::is_null_pointer<Rv>::value>;
+
+    template <class Rv, std::enable_if_t<_IsObjectPointer<Rv>::value, int> = 0>
+    void _store(Rv rv) noexcept {
+        _kind = _Kind::POINTER;
+        _value.pointerValue = static_cast<const void*>(rv);
+    }
+
+    template <class Rv,
+              std::enable_if_t<!std::is_arithmetic<Rv>::value && !std::is_enum<Rv>::value &&
+                                       !_IsObjectPointer<Rv>::value,
+                               int> = 0>
+    void _store(const Rv&) noexcept {}
+
+    _Kind _kind{_Kind::NONE};
+    union {
+        std::intmax_t signedValue;
+        std::uintmax_t unsignedValue;
+        double floatingValue;
+        const void* pointerValue;
+    } _value{};
+    mutable bool _formatted{false};
+    mutable char _message[64];
+};
+
+inline const char* ReturnValueError::what() const noexcept {
+    if (!_formatted) {
+        constexpr const char* prefix{"Return value indicated error"};
+        switch (_kind) {
+            case _Kind::SIGNED:
+                std::snprintf(_message, sizeof(_message), "%s: %jd", prefix, _value.signedValue);
+                break;
+            case _Kind::UNSIGNED:
+                std::snprintf(_message, sizeof(_message), "%s: %ju", prefix, _value.unsignedValue);
+                break;
+            case _Kind::FLOATING:
+                std::snprintf(_message, sizeof(_message), "%s: %g", prefix, _value.floatingValue);
+                break;
+            case _Kind::POINTER:
+                std::snprintf(_message, sizeof(_message), "%s: %p", prefix, _value.pointerValue);
+                break;
+            case _Kind::NONE:
+                std::snprintf(_message, sizeof(_message), "%s", prefix);
+                break;
+        }
+        _formatted = true;
+    }
+    return _message;
+}
+
 struct ReportReturnValueErrorPolicy {
     template <class Rv>
     static void handleError(const Rv& rv);
@@ -102,11 +242,21 @@ struct ReportReturnValueErrorPolicy {
 
 template <class Rv>
 void ReportReturnValueErrorPolicy::handleError(const Rv& rv) {
-    boost::format fmtr{"Return value indicated error: %d"};
-    fmtr % rv;
-    throw std::runtime_error(fmtr.str());
+    throw ReturnValueError{rv};
 }
 
+/**
+ * @brief Exception reporting an errno value.
+ *
+ * A std::system_error whose code() is the error in the generic category. The
+ * errno value is read by the ErrorPolicy right after the failed call, before
+ * the exception (and its message) is constructed.
+ */
+class ErrnoError : public std::system_error {
+public:
+    explicit ErrnoError(int error) : std::system_error{error, std::generic_category()} {}
+};
+
 struct ErrnoErrorPolicy {
     template <class Rv>
     static void handleError(const Rv&);
@@ -114,7 +264,9 @@ struct ErrnoErrorPolicy {
 
 template <class Rv>
 void ErrnoErrorPolicy::handleError(const Rv&) {
-    throw std::runtime_error(std::strerror(errno));
+    // read errno before anything (like allocating the exception) can change it
+    const int error{errno};
+    throw ErrnoError{error};
 }
 
 struct ErrorCodeErrorPolicy {
@@ -125,9 +277,63 @@ struct ErrorCodeErrorPolicy {
 template <class Rv>
 void ErrorCodeErrorPolicy::handleError(const Rv& rv) {
     static_assert(std::is_integral<std::decay_t<Rv>>::value, "Must be an integral value");
-    throw std::runtime_error(std::strerror(-rv));
+    throw ErrnoError{static_cast<int>(-rv)};
 }
 
+/**
+ * Tells ExpectedErrorPolicy that the error of a failed call is found in errno.
+ */
+struct ErrnoErrorSource {
+    template <class Rv>
+    static std::errc errorFrom(const Rv&) noexcept {
+        return static_cast<std::errc>(errno);
+    }
+};
+
+/**
+ * Tells ExpectedErrorPolicy that a failed call returns the negated error code
+ * (like ErrorCodeErrorPolicy).
+ */
+struct NegatedReturnValueErrorSource {
+    template <class Rv>
+    static std::errc errorFrom(const Rv& rv) noexcept {
+        static_assert(std::is_integral<std::decay_t<Rv>>::value, "Must be an integral value");
+        return static_cast<std::errc>(-rv);
+    }
+};
+
+/**
+ * @brief An ErrorPolicy that returns errors as values, instead of throwing.
+ *
+ * Checked calls using this policy return a Result that holds either the return
+ * value of the call or the error obtained from the ErrorSource (see
+ * ErrnoErrorSource and NegatedReturnValueErrorSource). Nothing is thrown, so
+ * this policy is suitable for calls that fail frequently and for code compiled
+ * with -fno-exceptions:
+ *
+ *  using ct = CallCheckContext<IsNotNegativeReturnCheckPolicy, ExpectedErrorPolicy<>>;
+ *  const auto bytesRead = ct::callChecked(read, fd, buf, sizeof(buf));
+ *  if (!bytesRead && bytesRead.error() == std::errc::resource_unavailable_try_again) {
+ *      ...
+ *  }
+ */
+template <class ErrorSource = ErrnoErrorSource>
+struct ExpectedErrorPolicy {
+    template <class Rv>
+    using ResultType = Result<std::decay_t<Rv>,
+                              std::decay_t<decltype(ErrorSource::errorFrom(std::declval<Rv>()))>>;
+
+    template <class Rv>
+    static ResultType<Rv> handleError(const Rv& rv) noexcept {
+        return fail(ErrorSource::errorFrom(rv));
+    }
+
+    template <class Rv>
+    static ResultType<Rv> handleOk(const Rv& rv) noexcept {
+        return rv;
+    }
+};
+
 using DefaultErrorPolicy = ReportReturnValueErrorPolicy;
 
 struct IsZeroReturnCheckPolicy {
@@ -181,9 +387,9 @@ template <class R = DefaultReturnCheckPolicy,
           class... Args>
 inline auto callChecked(Callable&& callable, Args&&... args) {
     ::cppc::_auxiliary::callPrecCallIfPresent<R>();
-    const auto retVal = callable(std::forward<Args>(args)...);
-    return _auxiliary::ReturnCheckWrapper<R, E, decltype(retVal)>::policyHandeledReturnValue(
-            retVal);
+    using Rv = std::decay_t<decltype(callable(std::forward<Args>(args)...))>;
+    return _auxiliary::ReturnCheckWrapper<R, E, Rv>::callAndHandleReturnValue(
+            callable, std::forward<Args>(args)...);
 }
 
 template <class Functor,
@@ -224,4 +430,51 @@ public:
     }
 };
 
+/**
+ * @brief A checked call to a function that is known at compile time.
+ *
+ * Unlike CallGuard, which stores a function pointer or functor, this class
+ * binds the function as a template argument. It is stateless and its
+ * operator() calls the function directly, so there is no indirect call for the
+ * compiler to see through. Arguments are forwarded to the function as is.
+ *
+ * A wrapped C API can thus be declared as a set of constexpr objects:
+ *
+ *  constexpr CheckedFunction<decltype(&getaddrinfo), &getaddrinfo, IsZeroReturnCheckPolicy,
+ *                            GetAddrInfoErrorPolicy> checkedGetaddrinfo{};
+ *
+ * In C++17, the alias Checked deduces the type of the function:
+ *
+ *  constexpr Checked<&getaddrinfo, IsZeroReturnCheckPolicy, GetAddrInfoErrorPolicy>
+ *          checkedGetaddrinfo{};
+ */
+template <class F,
+          F func,
+          class ReturnCheckPolicy = DefaultReturnCheckPolicy,
+          class ErrorPolicy = DefaultErrorPolicy>
+struct CheckedFunction {
+    static_assert(std::is_pointer<F>::value && std::is_function<std::remove_pointer_t<F>>::value,
+                  "CheckedFunction requires a pointer to a function");
+
+    template <class... Args>
+    inline auto operator()(Args&&... args) const {
+        return callChecked<ReturnCheckPolicy, ErrorPolicy>(_Call{}, std::forward<Args>(args)...);
+    }
+
+private:
+    struct _Call {
+        template <class... Args>
+        inline auto operator()(Args&&... args) const {
+            return func(std::forward<Args>(args)...);
+        }
+    };
+};
+
+#if __cplusplus >= 201703L
+template <auto func,
+          class ReturnCheckPolicy = DefaultReturnCheckPolicy,
+          class ErrorPolicy = DefaultErrorPolicy>
+using Checked = CheckedFunction<decltype(func), func, ReturnCheckPolicy, ErrorPolicy>;
+#endif
+
 }  // namespace cppc
@@ -16,5 +16,25 @@
 
 #pragma once
 
+#include "async.hpp"
+#include "batch.hpp"
 #include "checkcall.hpp"
+#include "deferredfree.hpp"
 #include "guard.hpp"
+#include "lazyguard.hpp"
+#include "resourcepool.hpp"
+#include "result.hpp"
+#include "retry.hpp"
+#include "slab.hpp"
+#include "statusarray.hpp"
+#include "threadlocalguard.hpp"
+#include "tracing.hpp"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include "uring.hpp"
+#endif
+#if __has_include(<linux/perf_event.h>)
+#include "perfcounters.hpp"
+#endif
+#endif
@@ -0,0 +1,298 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+#include "boundedqueue.hpp"
+#include "guard.hpp"
+
+namespace cppc {
+
+namespace _auxiliary {
+
+/**
+ * The handles waiting to be freed by one FreePolicy.
+ */
+class DeferredFreeQueueBase {
+public:
+    virtual ~DeferredFreeQueueBase() = default;
+
+    /**
+     * Free (at most a queue's worth of) queued handles and return how many were
+     * freed. Must not be called concurrently.
+     */
+    virtual std::size_t drain() noexcept = 0;
+
+    // the queues form a list that only ever grows, so it can be walked without a lock
+    DeferredFreeQueueBase *next{nullptr};
+};
+
+template <class FreePolicy, std::size_t capacity>
+class DeferredFreeQueue : public DeferredFreeQueueBase {
+public:
+    using Handle = std::decay_t<typename FreePolicy::ArgumentType>;
+
+    bool tryPush(Handle handle) noexcept { return _queue.tryPush(handle); }
+
+    std::size_t drain() noexcept override {
+        const FreePolicy freePolicy{};
+        Handle handle{};
+        std::size_t freed{0};
+        while (freed < capacity && _queue.tryPop(handle)) {
+            freePolicy(handle);
+            freed++;
+        }
+        return freed;
+    }
+
+private:
+    BoundedMpscQueue<Handle, capacity> _queue{};
+};
+
+/**
+ * @brief Owns the queues of all DeferredFree policies and the thread that empties them.
+ *
+ * The thread sleeps until a handle is queued. It then empties one queue after
+ * the other, so that handles are freed in batches of calls to the same free
+ * function. Producers only touch the reclaimer's mutex when the first handle
+ * is queued after the thread has started a round, so that the cost of waking
+ * it up is shared by all handles queued in the meantime.
+ *
+ * The reclaimer and its queues are never destroyed (like the slabs of a
+ * SlabDepot), so that other threads can still queue handles while the program
+ * exits. At exit, the thread frees whatever is left and stops. Handles queued
+ * afterwards are freed right away.
+ */
+class DeferredReclaimer {
+public:
+    static DeferredReclaimer &instance() {
+        static DeferredReclaimer &reclaimer{*new DeferredReclaimer};
+        static _Stopper stopper{reclaimer};
+        return reclaimer;
+    }
+
+    /**
+     * Whether the reclaimer's thread has stopped. Can be called at any time.
+     */
+    static bool stopped() noexcept { return _stopped().load(std::memory_order_seq_cst); }
+
+    DeferredReclaimer(const DeferredReclaimer &) = delete;
+    DeferredReclaimer &operator=(const DeferredReclaimer &) = delete;
+
+    template <class FreePolicy, std::size_t capacity>
+    DeferredFreeQueue<FreePolicy, capacity> &makeQueue() {
+        auto *queue = new DeferredFreeQueue<FreePolicy, capacity>;
+        queue->next = _queues.load(std::memory_order_relaxed);
+        while (!_queues.compare_exchange_weak(queue->next, queue, std::memory_order_release,
+                                              std::memory_order_relaxed)) {
+        }
+        return *queue;
+    }
+
+    /**
+     * Tell the reclaimer that a handle has been queued.
+     */
+    void notify() noexcept {
+        if (_pending.fetch_add(1, std::memory_order_release) == 0) {
+            // synchronize with the reclaimer checking _pending before it waits
+            { std::lock_guard<std::mutex> lock{_mutex}; }
+            _wakeUp.notify_one();
+        }
+    }
+
+    /**
+     * Free all handles that were queued before the call, on the calling thread.
+     * A queue never holds more handles than a single drain() frees.
+     */
+    void flush() {
+        std::lock_guard<std::mutex> lock{_drainMutex};
+        _drainAll();
+    }
+
+    /**
+     * Free the handles in a single queue on the calling thread.
+     */
+    void drain(DeferredFreeQueueBase &queue) noexcept {
+        std::lock_guard<std::mutex> lock{_drainMutex};
+        queue.drain();
+    }
+
+private:
+    /**
+     * Stops the reclaimer's thread at program exit.
+     */
+    struct _Stopper {
+        DeferredReclaimer &reclaimer;
+
+        ~_Stopper() { reclaimer._stop(); }
+    };
+
+    DeferredReclaimer() : _thread{[this]() { _run(); }} {}
+
+    void _stop() {
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            _stopping = true;
+        }
+        _wakeUp.notify_one();
+        _thread.join();
+        _stopped().store(true, std::memory_order_seq_cst);
+        // a producer that queued a handle before seeing _stopped drains its queue itself
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        flush();
+    }
+
+    static std::atomic<bool> &_stopped() noexcept {
+        // constant-initialized and trivially destructible, so usable after exit
+        static std::atomic<bool> stopped{false};
+        return stopped;
+    }
+
+    void _drainAll() noexcept {
+        for (auto *queue = _queues.load(std::memory_order_acquire); queue != nullptr;
+             queue = queue->next) {
+            queue->drain();
+        }
+    }
+
+    void _run() {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock{_mutex};
+                _wakeUp.wait(lock, [this]() {
+                    return _stopping || _pending.load(std::memory_order_relaxed) > 0;
+                });
+                if (_stopping) {
+                    return;
+                }
+            }
+            _pending.exchange(0, std::memory_order_acquire);
+            std::lock_guard<std::mutex> lock{_drainMutex};
+            _drainAll();
+        }
+    }
+
+    // protects _stopping and orders wake-ups
+    std::mutex _mutex{};
+    std::condition_variable _wakeUp{};
+    bool _stopping{false};
+    std::atomic<std::size_t> _pending{0};
+
+    // held while freeing handles, since every queue has a single consumer
+    std::mutex _drainMutex{};
+    std::atomic<DeferredFreeQueueBase *> _queues{nullptr};
+
+    std::thread _thread;
+};
+
+}  // namespace _auxiliary
+
+/**
+ * @brief A FreePolicy that frees resources on a background thread.
+ *
+ * Some free functions are expensive, e.g., freeaddrinfo on a long list,
+ * RSA_free (which zeroes the key) or munmap of a large mapping. With this
+ * policy, destroying a Guard merely appends the handle to a lock-free queue.
+ * A background thread frees the queued handles in batches, one free function
+ * at a time:
+ *
+ *  Guard<addrinfo *, DeferredFree<FreeWith<&freeaddrinfo>>> result{};
+ *
+ * FreePolicy must be a stateless, default-constructible FreePolicy that
+ * declares its ArgumentType (such as FreeFunction) and does not throw. Its
+ * null value, if any, is used by the DeferredFree policy as well, and so is
+ * its declaration that it only frees memory (see OnlyFreesMemoryPolicy). Every
+ * FreePolicy gets a queue of the given capacity. If the queue is full (or
+ * cannot be created), the handle is freed right away on the calling thread
+ * instead, so that the queue cannot grow without bounds.
+ *
+ * Handles are freed asynchronously, so a DeferredFree policy must only be used
+ * if nothing depends on a resource being freed in time. flushDeferredFrees()
+ * frees all handles queued so far, e.g., before checking for leaks.
+ */
+template <class FreePolicy, std::size_t capacity = 1024>
+struct DeferredFree {
+    static_assert(std::is_empty<FreePolicy>::value &&
+                          std::is_default_constructible<FreePolicy>::value,
+                  "Must be a stateless FreePolicy");
+
+    using ArgumentType = typename FreePolicy::ArgumentType;
+
+    static constexpr bool onlyFreesMemory{_auxiliary::OnlyFreesMemory<FreePolicy>::value};
+
+    void operator()(ArgumentType handle) const noexcept {
+        auto *queue = _auxiliary::DeferredReclaimer::stopped() ? nullptr : _queue();
+        if (queue == nullptr || !queue->tryPush(handle)) {
+            FreePolicy{}(handle);
+            return;
+        }
+        // cannot throw, since _queue() has created the reclaimer
+        auto &reclaimer = _auxiliary::DeferredReclaimer::instance();
+        reclaimer.notify();
+        // the reclaimer may have stopped before it could see the handle
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_auxiliary::DeferredReclaimer::stopped()) {
+            reclaimer.drain(*queue);
+        }
+    }
+
+    template <class F = FreePolicy>
+    static constexpr auto nullValue() noexcept -> decltype(F::nullValue()) {
+        return F::nullValue();
+    }
+
+private:
+    /**
+     * The queue of this FreePolicy, or nullptr if it (or the reclaimer and its
+     * thread) cannot be created. Creating it is retried on the next call.
+     */
+    static _auxiliary::DeferredFreeQueue<FreePolicy, capacity> *_queue() noexcept {
+        try {
+            static auto &queue = _auxiliary::DeferredReclaimer::instance()
+                                         .template makeQueue<FreePolicy, capacity>();
+            return &queue;
+        } catch (...) {
+            return nullptr;
+        }
+    }
+};
+
+#if __cplusplus < 201703L
+template <class FreePolicy, std::size_t capacity>
+constexpr bool DeferredFree<FreePolicy, capacity>::onlyFreesMemory;
+#endif
+
+/**
+ * @brief Free all handles queued by DeferredFree policies so far.
+ *
+ * The handles are freed on the calling thread. When this function returns,
+ * every handle queued before the call has been freed. Must not be called by a
+ * free function that a DeferredFree policy calls.
+ */
+inline void flushDeferredFrees() {
+    if (!_auxiliary::DeferredReclaimer::stopped()) {
+        _auxiliary::DeferredReclaimer::instance().flush();
+    }
+}
+
+}  // namespace cppc
@@ -0,0 +1,305 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace cppc {
+
+/**
+ * @brief The result of a call that runs on an Executor.
+ *
+ * This is a thin wrapper around std::future. get() returns the result of the
+ * call or rethrows the exception it threw. Unlike a plain std::future, a
+ * CallFuture waits for the call to complete when it is destroyed (or assigned
+ * to). Thus, anything the call refers to (such as an out-parameter owned by a
+ * Guard) only needs to outlive the CallFuture:
+ *
+ *  Guard<addrinfo *, FreeWith<&freeaddrinfo>> result{nullptr};
+ *  auto future = callCheckedAsync<IsZeroReturnCheckPolicy, GaiErrorPolicy>(
+ *          Executor::instance(), getaddrinfo, host, nullptr, &hints, &result.get());
+ *  // result is not destroyed before the call completes
+ */
+template <class T>
+class CallFuture {
+public:
+    CallFuture() = default;
+
+    explicit CallFuture(std::future<T> &&future) noexcept : _future{std::move(future)} {}
+
+    CallFuture(CallFuture &&) noexcept = default;
+
+    CallFuture &operator=(CallFuture &&other) noexcept {
+        _waitIfValid();
+        _future = std::move(other._future);
+        return *this;
+    }
+
+    ~CallFuture() { _waitIfValid(); }
+
+    T get() { return _future.get(); }
+
+    bool valid() const noexcept { return _future.valid(); }
+
+    void wait() const { _future.wait(); }
+
+    template <class Rep, class Period>
+    std::future_status waitFor(const std::chrono::duration<Rep, Period> &timeout) const {
+        return _future.wait_for(timeout);
+    }
+
+private:
+    void _waitIfValid() const noexcept {
+        if (_future.valid()) {
+            _future.wait();
+        }
+    }
+
+    std::future<T> _future{};
+};
+
+/**
+ * @brief A fixed-size pool of threads that run tasks in the background.
+ *
+ * Every worker thread has its own task queue. Tasks submitted by a worker go
+ * to the front of its own queue; other tasks are distributed round-robin.
+ * Workers take tasks from the front of their own queue and, once it is
+ * empty, steal from the back of the other workers' queues.
+ *
+ * The number of queued tasks is bounded. If all queues are full, submit()
+ * blocks until a worker takes a task. The exception are tasks submitted by a
+ * worker itself: these run right away on the submitting thread, since the
+ * worker would otherwise wait for itself.
+ *
+ * A task that waits for another task it has submitted relies on a different
+ * worker stealing that task. Hence, such tasks must not run on an Executor
+ * with a single thread.
+ *
+ * The destructor runs all queued tasks and joins the worker threads.
+ */
+class Executor {
+    template <class Task>
+    using _ResultOf = decltype(std::declval<std::decay_t<Task> &>()());
+
+public:
+    explicit Executor(std::size_t numThreads = defaultNumThreads(),
+                      std::size_t capacity = 1024);
+
+    Executor(const Executor &) = delete;
+    Executor &operator=(const Executor &) = delete;
+
+    ~Executor();
+
+    /**
+     * A process-wide executor for callers that do not need their own.
+     */
+    static Executor &instance() {
+        static Executor executor{};
+        return executor;
+    }
+
+    static std::size_t defaultNumThreads() noexcept {
+        return std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    template <class Task>
+    CallFuture<_ResultOf<Task>> submit(Task &&task);
+
+private:
+    struct _TaskBase {
+        virtual ~_TaskBase() = default;
+        virtual void run() = 0;
+    };
+
+    template <class R>
+    struct _Task : public _TaskBase {
+        explicit _Task(std::packaged_task<R()> &&task) : task{std::move(task)} {}
+        void run() override { task(); }
+        std::packaged_task<R()> task;
+    };
+
+    struct _Worker {
+        std::mutex mutex{};
+        std::deque<std::unique_ptr<_TaskBase>> tasks{};
+        std::thread thread{};
+    };
+
+    /**
+     * The executor and index of the worker running on this thread (if any).
+     */
+    struct _CurrentWorker {
+        const Executor *executor;
+        std::size_t index;
+    };
+
+    static _CurrentWorker &_currentWorker() noexcept {
+        thread_local _CurrentWorker current{nullptr, 0};
+        return current;
+    }
+
+    bool _tryReserve() noexcept;
+    void _enqueue(std::unique_ptr<_TaskBase> task);
+    std::unique_ptr<_TaskBase> _take(std::size_t index);
+    void _work(std::size_t index);
+
+    const std::size_t _capacity;
+    std::vector<std::unique_ptr<_Worker>> _workers{};
+    std::atomic<std::size_t> _nextWorker{0};
+
+    // the number of queued tasks (including tasks that are about to be queued)
+    std::atomic<std::size_t> _queued{0};
+
+    // only used to put threads to sleep and wake them up; protects _stopping
+    std::mutex _mutex{};
+    std::condition_variable _workAvailable{};
+    std::condition_variable _spaceAvailable{};
+    std::atomic<std::size_t> _idleWorkers{0};
+    std::atomic<std::size_t> _blockedSubmitters{0};
+    bool _stopping{false};
+};
+
+inline Executor::Executor(std::size_t numThreads, std::size_t capacity)
+        : _capacity{std::max<std::size_t>(capacity, 1)} {
+    numThreads = std::max<std::size_t>(numThreads, 1);
+    for (std::size_t i = 0; i < numThreads; i++) {
+        _workers.emplace_back(new _Worker);
+    }
+    for (std::size_t i = 0; i < numThreads; i++) {
+        _workers[i]->thread = std::thread{[this, i]() { _work(i); }};
+    }
+}
+
+inline Executor::~Executor() {
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _stopping = true;
+    }
+    _workAvailable.notify_all();
+    for (auto &worker : _workers) {
+        worker->thread.join();
+    }
+}
+
+template <class Task>
+CallFuture<Executor::_ResultOf<Task>> Executor::submit(Task &&task) {
+    using R = _ResultOf<Task>;
+    std::packaged_task<R()> packagedTask{std::forward<Task>(task)};
+    CallFuture<R> future{packagedTask.get_future()};
+    _enqueue(std::make_unique<_Task<R>>(std::move(packagedTask)));
+    return future;
+}
+
+inline bool Executor::_tryReserve() noexcept {
+    std::size_t queued{_queued.load()};
+    while (queued < _capacity) {
+        if (_queued.compare_exchange_weak(queued, queued + 1)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void Executor::_enqueue(std::unique_ptr<_TaskBase> task) {
+    const _CurrentWorker current{_currentWorker()};
+    const bool onWorker{current.executor == this};
+    if (!_tryReserve()) {
+        if (onWorker) {
+            task->run();
+            return;
+        }
+        std::unique_lock<std::mutex> lock{_mutex};
+        _blockedSubmitters++;
+        _spaceAvailable.wait(lock, [this]() { return _tryReserve(); });
+        _blockedSubmitters--;
+    }
+    _Worker &worker{onWorker ? *_workers[current.index]
+                             : *_workers[_nextWorker++ % _workers.size()]};
+    {
+        std::lock_guard<std::mutex> workerLock{worker.mutex};
+        if (onWorker) {
+            worker.tasks.push_front(std::move(task));
+        } else {
+            worker.tasks.push_back(std::move(task));
+        }
+    }
+    // a worker increments _idleWorkers before it checks _queued and goes to sleep
+    if (_idleWorkers.load() > 0) {
+        { std::lock_guard<std::mutex> lock{_mutex}; }
+        _workAvailable.notify_one();
+    }
+}
+
+inline std::unique_ptr<Executor::_TaskBase> Executor::_take(std::size_t index) {
+    std::unique_ptr<_TaskBase> task{};
+    {
+        _Worker &own{*_workers[index]};
+        std::lock_guard<std::mutex> lock{own.mutex};
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.front());
+            own.tasks.pop_front();
+        }
+    }
+    for (std::size_t i = 1; !task && i < _workers.size(); i++) {
+        _Worker &victim{*_workers[(index + i) % _workers.size()]};
+        std::lock_guard<std::mutex> lock{victim.mutex};
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+        }
+    }
+    if (task) {
+        _queued--;
+        if (_blockedSubmitters.load() > 0) {
+            { std::lock_guard<std::mutex> lock{_mutex}; }
+            _spaceAvailable.notify_one();
+        }
+    }
+    return task;
+}
+
+inline void Executor::_work(std::size_t index) {
+    _currentWorker() = _CurrentWorker{this, index};
+    while (true) {
+        if (auto task = _take(index)) {
+            task->run();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock{_mutex};
+        _idleWorkers++;
+        // _queued also counts tasks that are about to be queued or were just taken by
+        // another worker, so the worker may spin briefly
+        _workAvailable.wait(lock, [this]() { return _stopping || _queued.load() > 0; });
+        _idleWorkers--;
+        if (_stopping && _queued.load() == 0) {
+            return;
+        }
+    }
+}
+
+}  // namespace cppc
@@ -16,11 +16,15 @@
 
 #pragma once
 
+#include <atomic>
+#include <cstddef>
 #include <functional>
 #include <memory>
 #include <type_traits>
 #include <utility>
 
+#include "probes.hpp"
+
 namespace cppc {
 
 namespace _auxiliary {
@@ -102,6 +106,170 @@ template <class T>
 using PointerOrRefType =
         std::conditional_t<std::is_pointer<T>::value, T, std::add_lvalue_reference_t<T>>;
 
+/**
+ * Exposes the parameter type of a pointer to a unary (free) function.
+ */
+template <class F>
+struct FreeFunctionTraits;
+
+template <class Rv, class Arg>
+struct FreeFunctionTraits<Rv (*)(Arg)> {
+    using ArgumentType = Arg;
+};
+#if __cplusplus >= 201703L
+template <class Rv, class Arg>
+struct FreeFunctionTraits<Rv (*)(Arg) noexcept> {
+    using ArgumentType = Arg;
+};
+#endif
+
+/**
+ * Detects whether a FreePolicy declares a null value, i.e., a value of the
+ * guarded type that does not need to be freed.
+ */
+template <class FreePolicy, class = void>
+struct HasNullValue : public std::false_type {};
+
+template <class FreePolicy>
+struct HasNullValue<FreePolicy, decltype(void(std::decay_t<FreePolicy>::nullValue()))>
+        : public std::true_type {};
+
+/**
+ * A Guard can only use the null value of its FreePolicy to mark itself as
+ * released if it stores the guarded value directly (as opposed to, say, a
+ * pointer to it).
+ */
+template <class FreePolicy, class StorageType, bool = HasNullValue<FreePolicy>::value>
+struct UsesNullValue : public std::false_type {};
+
+template <class FreePolicy, class StorageType>
+struct UsesNullValue<FreePolicy, StorageType, true>
+        : public std::is_same<std::decay_t<decltype(std::decay_t<FreePolicy>::nullValue())>,
+                              StorageType> {};
+
+/**
+ * A StoragePolicy may declare a static constexpr bool 'pinned' to state that
+ * the guarded value must not change its address. Guards using such a policy
+ * cannot be moved.
+ */
+template <class StoragePolicy, class = void>
+struct IsPinned : public std::false_type {};
+
+template <class StoragePolicy>
+struct IsPinned<StoragePolicy, decltype(void(StoragePolicy::pinned))>
+        : public std::integral_constant<bool, StoragePolicy::pinned> {};
+
+/**
+ * A FreePolicy may declare a static constexpr bool 'onlyFreesMemory' to state
+ * that releasing a resource has no effect besides freeing memory, so that it
+ * can be skipped once the process is about to exit (see beginFastExit()).
+ */
+template <class FreePolicy, class = void>
+struct OnlyFreesMemory : public std::false_type {};
+
+template <class FreePolicy>
+struct OnlyFreesMemory<FreePolicy, decltype(void(std::decay_t<FreePolicy>::onlyFreesMemory))>
+        : public std::integral_constant<bool, std::decay_t<FreePolicy>::onlyFreesMemory> {};
+
+/**
+ * Set once the process has begun to exit. Constant-initialized and trivially
+ * destructible, so that it can be used by the destructors of static objects.
+ */
+inline std::atomic<bool> &fastExitFlag() noexcept {
+    static std::atomic<bool> fastExit{false};
+    return fastExit;
+}
+
+/**
+ * Whether a Guard can skip its release, given whether its FreePolicy only
+ * frees memory.
+ */
+inline bool skipsRelease(std::false_type) noexcept { return false; }
+
+inline bool skipsRelease(std::true_type) noexcept {
+    return fastExitFlag().load(std::memory_order_relaxed);
+}
+
+/**
+ * The guarded type fits into an inline buffer of N bytes (aligned like
+ * std::max_align_t).
+ */
+template <class T, std::size_t N>
+struct FitsInline
+        : public std::integral_constant<bool, sizeof(T) <= N &&
+                                                      alignof(T) <= alignof(std::max_align_t)> {};
+
+/**
+ * Holds the FreePolicy of a Guard. Stateless policies are stored as an empty
+ * base class, so that they do not add to the size of the Guard.
+ */
+template <class FreePolicy,
+          bool = std::is_empty<FreePolicy>::value && !std::is_final<FreePolicy>::value>
+class FreePolicyHolder {
+public:
+    FreePolicyHolder() : _freeFunc{} {}
+
+    template <class F>
+    explicit FreePolicyHolder(F &&f) : _freeFunc{std::forward<F>(f)} {}
+
+    std::add_lvalue_reference_t<FreePolicy> _freePolicy() noexcept { return _freeFunc; }
+
+private:
+    FreePolicy _freeFunc;
+};
+
+template <class FreePolicy>
+class FreePolicyHolder<FreePolicy, true> : private FreePolicy {
+public:
+    FreePolicyHolder() : FreePolicy{} {}
+
+    template <class F>
+    explicit FreePolicyHolder(F &&f) : FreePolicy(std::forward<F>(f)) {}
+
+    FreePolicy &_freePolicy() noexcept { return *this; }
+};
+
+/**
+ * Keeps track of whether a Guard still owns its resource. In general, this
+ * requires a flag. If the FreePolicy declares a null value, the guarded value
+ * itself is set to the null value instead, and no additional storage is needed.
+ */
+template <class FreePolicy, class StorageType, bool = UsesNullValue<FreePolicy, StorageType>::value>
+class ReleaseState {
+public:
+    template <class StoragePolicy>
+    static StorageType _createDefault() {
+        return StoragePolicy::createFrom();
+    }
+
+    bool _isReleased(const StorageType &) const noexcept { return _released; }
+    void _markReleased(StorageType &) noexcept { _released = true; }
+    void _markAcquired() noexcept { _released = false; }
+
+private:
+    bool _released{false};
+};
+
+template <class FreePolicy, class StorageType>
+class ReleaseState<FreePolicy, StorageType, true> {
+public:
+    /*
+     * A default-constructed Guard holds the null value, e.g., so that it can
+     * be passed to an out-parameter. Unless it is assigned another value, it
+     * will not call the FreePolicy.
+     */
+    template <class StoragePolicy>
+    static StorageType _createDefault() {
+        return StoragePolicy::createFrom(std::decay_t<FreePolicy>::nullValue());
+    }
+
+    bool _isReleased(const StorageType &t) const noexcept {
+        return t == std::decay_t<FreePolicy>::nullValue();
+    }
+    void _markReleased(StorageType &t) noexcept { t = std::decay_t<FreePolicy>::nullValue(); }
+    void _markAcquired() noexcept {}
+};
+
 }  // namespace _auxiliary
 
 template <class T>
@@ -145,54 +313,198 @@ struct UniquePointerStoragePolicy {
     }
 };
 
+/**
+ * @brief A StoragePolicy that stores the guarded value inside the Guard if it fits into N bytes and
+ * on the heap otherwise.
+ *
+ * Either way, the guarded value keeps its address for as long as the Guard
+ * lives, so it can be passed to C APIs that keep pointers to it. To that end,
+ * a Guard storing its value inline is pinned: it cannot be moved. If the value
+ * does not fit, it is allocated as with UniquePointerStoragePolicy and the Guard
+ * can be moved.
+ */
+template <class T, std::size_t N>
+struct InlineOrHeapStoragePolicy
+        : public std::conditional_t<_auxiliary::FitsInline<std::remove_reference_t<T>, N>::value,
+                                    ByValueStoragePolicy<T>, UniquePointerStoragePolicy<T>> {
+    static constexpr bool isInline{
+            _auxiliary::FitsInline<std::remove_reference_t<T>, N>::value};
+    static constexpr bool pinned{isInline};
+};
+
 template <class T>
 using _FreePolicyFunctionType = void(_auxiliary::PointerOrRefType<T>);
 
 template <class T>
 using DefaultFreePolicy = std::function<_FreePolicyFunctionType<T>>;
 
+/**
+ * @brief A FreePolicy that calls a free function that is known at compile time.
+ *
+ * Contrary to DefaultFreePolicy or a function pointer, this policy is
+ * stateless. It does not add to the size of a Guard and the call to the free
+ * function is a direct call that the compiler can inline.
+ *
+ * If the free function takes a pointer, a Guard using this policy never passes
+ * a nullptr to it (just like std::unique_ptr never passes a nullptr to its
+ * deleter). The nullptr is used to mark a moved-from Guard, so that the Guard
+ * does not need any storage besides the guarded pointer itself:
+ *
+ *  Guard<RSA *, FreeFunction<decltype(&RSA_free), &RSA_free>>
+ *
+ * In C++17 the FreeWith alias-template saves some typing:
+ *
+ *  Guard<RSA *, FreeWith<&RSA_free>>
+ */
+template <class F, F freeFunc>
+struct FreeFunction {
+    static_assert(std::is_pointer<F>::value, "Must be a function pointer");
+
+    using ArgumentType = typename _auxiliary::FreeFunctionTraits<F>::ArgumentType;
+
+    inline void operator()(ArgumentType arg) const noexcept(_auxiliary::IsNoexcept<F>::value) {
+        freeFunc(arg);
+    }
+
+    template <class A = ArgumentType, typename = std::enable_if_t<std::is_pointer<A>::value>>
+    static constexpr A nullValue() noexcept {
+        return nullptr;
+    }
+};
+
+#if __cplusplus >= 201703L
+template <auto freeFunc>
+using FreeWith = FreeFunction<decltype(freeFunc), freeFunc>;
+#endif
+
+/**
+ * @brief Declares that a FreePolicy does nothing but free memory.
+ *
+ * Once beginFastExit() has been called, Guards using such a policy no longer
+ * release their resources, since the operating system is about to reclaim the
+ * memory anyway. FreePolicies with other effects (e.g., flushing and closing
+ * a file or shutting down a connection) must not be declared this way:
+ *
+ *  using ConfigGuard = Guard<config_t *, OnlyFreesMemoryPolicy<FreeWith<&config_free>>>;
+ */
+template <class FreePolicy>
+struct OnlyFreesMemoryPolicy : public FreePolicy {
+    using FreePolicy::FreePolicy;
+
+    static constexpr bool onlyFreesMemory{true};
+};
+
+#if __cplusplus < 201703L
+template <class FreePolicy>
+constexpr bool OnlyFreesMemoryPolicy<FreePolicy>::onlyFreesMemory;
+#endif
+
+/**
+ * @brief Skip the releases that only free memory from now on.
+ *
+ * Call this when the process is about to exit, e.g., at the end of main() or
+ * before calling std::exit(). Destroying the remaining static and long-lived
+ * Guards then only runs the releases that have effects besides freeing memory
+ * (see OnlyFreesMemoryPolicy); the others would merely delay the exit. Only
+ * destructors skip releases: a Guard that is assigned to still releases its
+ * previous resource.
+ *
+ * This cannot be undone and applies to all threads, including threads that are
+ * still running. Any Guard with such a policy that is destroyed afterwards, on
+ * whatever thread, leaks its resource. So only call this once no thread
+ * destroys such Guards in a loop anymore (e.g., after joining the workers).
+ */
+inline void beginFastExit() noexcept {
+    _auxiliary::fastExitFlag().store(true, std::memory_order_relaxed);
+}
+
+inline bool fastExitBegun() noexcept {
+    return _auxiliary::fastExitFlag().load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Declares the null value of a FreePolicy.
+ *
+ * A FreePolicy may provide a static function nullValue() that returns a
+ * value of the guarded type which does not need to be freed, e.g., nullptr
+ * for pointers or -1 for file descriptors. Guards that store their value
+ * directly (i.e., use ByValueStoragePolicy) then use this value to mark
+ * themselves as moved-from, instead of an additional flag. Together with a
+ * stateless FreePolicy, this makes the Guard exactly as large as the value it
+ * guards. A Guard holding the null value does not call its FreePolicy.
+ *
+ * This adaptor adds a null value to an existing (stateless) FreePolicy:
+ *
+ *  using FdGuard = Guard<int, WithNullValue<FreeWith<&close>, int, -1>>;
+ */
+template <class FreePolicy, class T, T null>
+struct WithNullValue : public FreePolicy {
+    using FreePolicy::FreePolicy;
+
+    static constexpr T nullValue() noexcept { return null; }
+};
+
 template <class Type,
           class FreePolicy = DefaultFreePolicy<Type>,
           class StoragePolicy = ByValueStoragePolicy<Type>>
-class Guard {
+class Guard
+        : private _auxiliary::FreePolicyHolder<FreePolicy>,
+          private _auxiliary::ReleaseState<FreePolicy, typename StoragePolicy::StorageType> {
     static_assert(!std::is_reference<Type>::value, "Cannot guard references");
 
 private:
     using _RawType = std::decay_t<Type>;
+    using _FreePolicyHolder = _auxiliary::FreePolicyHolder<FreePolicy>;
+    using _ReleaseState =
+            _auxiliary::ReleaseState<FreePolicy, typename StoragePolicy::StorageType>;
+
+    // Guards with pinned storage have no move operations: in their place, they
+    // declare a constructor and assignment from a type that cannot be named
+    struct _NotMovable {
+        explicit _NotMovable() = default;
+    };
+    using _MoveSource = std::conditional_t<_auxiliary::IsPinned<StoragePolicy>::value,
+                                           _NotMovable, Guard &&>;
 
 public:
     template <class F = FreePolicy,
               typename = std::enable_if_t<std::is_default_constructible<F>::value>>
-    Guard() : _guarded{StoragePolicy::createFrom()}, _freeFunc{} {}
+    Guard()
+            : _FreePolicyHolder{},
+              _guarded{_ReleaseState::template _createDefault<StoragePolicy>()} {}
 
     Guard(std::remove_reference_t<FreePolicy> &&func)
-            : _guarded{StoragePolicy::createFrom()}, _freeFunc{std::move(func)} {}
+            : _FreePolicyHolder{std::move(func)},
+              _guarded{_ReleaseState::template _createDefault<StoragePolicy>()} {}
 
     // if the FreePolicy is a reference, we need to initialize a potential
     // non-const ref from a non-const ref
     Guard(std::conditional_t<std::is_reference<FreePolicy>::value, FreePolicy, const FreePolicy &>
                   func)
-            : _guarded{StoragePolicy::createFrom()}, _freeFunc{func} {}
+            : _FreePolicyHolder{func},
+              _guarded{_ReleaseState::template _createDefault<StoragePolicy>()} {}
 
     Guard(std::conditional_t<std::is_reference<FreePolicy>::value, FreePolicy, const FreePolicy &>
                   func,
           const _RawType &t)
-            : _guarded{StoragePolicy::createFrom(t)}, _freeFunc{func} {}
+            : _FreePolicyHolder{func}, _guarded{StoragePolicy::createFrom(t)} {}
 
     Guard(std::remove_reference_t<FreePolicy> &&func, const _RawType &t)
-            : _guarded{StoragePolicy::createFrom(t)}, _freeFunc{std::move(func)} {}
+            : _FreePolicyHolder{std::move(func)}, _guarded{StoragePolicy::createFrom(t)} {}
 
     template <class F = FreePolicy,
               typename = std::enable_if_t<std::is_default_constructible<F>::value>>
-    Guard(const _RawType &t) : _guarded{StoragePolicy::createFrom(t)}, _freeFunc{} {}
+    Guard(const _RawType &t) : _FreePolicyHolder{}, _guarded{StoragePolicy::createFrom(t)} {}
 
     Guard(const Guard &) = delete;
 
-    Guard(Guard &&other);
+    Guard(_MoveSource other) noexcept(
+            std::is_nothrow_move_constructible<typename StoragePolicy::StorageType>::value
+                    && std::is_nothrow_move_constructible<FreePolicy>::value);
 
     Guard &operator=(const Guard &) = delete;
 
-    Guard &operator=(Guard &&other);
+    Guard &operator=(_MoveSource other);
 
     /**@brief Release the resource held by this guard
      *
@@ -211,22 +523,23 @@ public:
 
 private:
     typename StoragePolicy::StorageType _guarded;
-    bool _released{false};
-    FreePolicy _freeFunc;
     inline void _releaseIfNecessary() noexcept(_auxiliary::IsNoexcept<FreePolicy>::value);
 };
 
 template <class Type, class FreePolicy, class StoragePolicy>
-Guard<Type, FreePolicy, StoragePolicy>::Guard(Guard &&other)
-        : _guarded{std::move(other._guarded)}, _freeFunc{std::move(other._freeFunc)} {
-    other._released = true;
+Guard<Type, FreePolicy, StoragePolicy>::Guard(_MoveSource other) noexcept(
+        std::is_nothrow_move_constructible<typename StoragePolicy::StorageType>::value
+                && std::is_nothrow_move_constructible<FreePolicy>::value)
+        : _FreePolicyHolder{std::move(other._freePolicy())}, _guarded{std::move(other._guarded)} {
+    other._markReleased(other._guarded);
 }
 
 template <class Type, class FreePolicy, class StoragePolicy>
 inline void Guard<Type, FreePolicy, StoragePolicy>::_releaseIfNecessary() noexcept(
         _auxiliary::IsNoexcept<FreePolicy>::value) {
-    if (!_released) {
-        _freeFunc(StoragePolicy::getFrom(_guarded));
+    if (!this->_isReleased(_guarded)) {
+        CPPC_PROBE1(guard_release, this);
+        this->_freePolicy()(StoragePolicy::getFrom(_guarded));
     }
 }
 template <class Type, class FreePolicy, class StoragePolicy>
@@ -242,17 +555,19 @@ Type &Guard<Type, FreePolicy, StoragePolicy>::get() {
 template <class Type, class FreePolicy, class StoragePolicy>
 Guard<Type, FreePolicy, StoragePolicy>::~Guard() noexcept(
         _auxiliary::IsNoexcept<FreePolicy>::value) {
-    _releaseIfNecessary();
+    if (!_auxiliary::skipsRelease(_auxiliary::OnlyFreesMemory<FreePolicy>{})) {
+        _releaseIfNecessary();
+    }
 }
 
 template <class Type, class FreePolicy, class StoragePolicy>
 Guard<Type, FreePolicy, StoragePolicy> &Guard<Type, FreePolicy, StoragePolicy>::operator=(
-        Guard &&other) {
+        _MoveSource other) {
     _releaseIfNecessary();
-    _released = false;
-    _freeFunc = std::move(other._freeFunc);
+    this->_markAcquired();
+    this->_freePolicy() = std::move(other._freePolicy());
     _guarded = std::move(other._guarded);
-    other._released = true;
+    other._markReleased(other._guarded);
     return *this;
 }
 
@@ -0,0 +1,204 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "checkcall.hpp"
+#include "guard.hpp"
+
+namespace cppc {
+
+/**
+ * @brief An InitPolicy for LazyGuards that are only used by one thread at a time.
+ */
+class SingleThreadedInitPolicy {
+public:
+    bool done() const noexcept { return _done; }
+
+    template <class F>
+    void once(F &&f) {
+        if (!_done) {
+            f();
+            _done = true;
+        }
+    }
+
+    void setDone() noexcept { _done = true; }
+
+private:
+    bool _done{false};
+};
+
+/**
+ * @brief An InitPolicy for LazyGuards that are shared between threads.
+ *
+ * Once the resource exists, checking for it is a single atomic load. Until
+ * then, concurrent callers wait on a mutex for the first one to create it. If
+ * the creation throws, the next caller tries again (like std::call_once).
+ */
+class ThreadSafeInitPolicy {
+public:
+    bool done() const noexcept { return _done.load(std::memory_order_acquire); }
+
+    template <class F>
+    void once(F &&f) {
+        std::lock_guard<std::mutex> lock{_mutex};
+        if (!_done.load(std::memory_order_relaxed)) {
+            f();
+            _done.store(true, std::memory_order_release);
+        }
+    }
+
+    void setDone() noexcept { _done.store(true, std::memory_order_relaxed); }
+
+private:
+    std::atomic<bool> _done{false};
+    std::mutex _mutex{};
+};
+
+/**
+ * @brief Creates a resource with a checked call to a function with stored arguments.
+ *
+ * The arguments are passed as lvalues, so that a failed creation can be
+ * retried.
+ */
+template <class ReturnCheckPolicy, class ErrorPolicy, class Callable, class... Args>
+class CheckedCreate {
+public:
+    template <class C, class... A>
+    explicit CheckedCreate(C &&callable, A &&... args)
+            : _callable{std::forward<C>(callable)}, _args{std::forward<A>(args)...} {}
+
+    auto operator()() {
+        auto call = [this](auto &... args) {
+            return callChecked<ReturnCheckPolicy, ErrorPolicy>(_callable, args...);
+        };
+        return _auxiliary::apply(call, _args);
+    }
+
+private:
+    Callable _callable;
+    std::tuple<Args...> _args;
+};
+
+/**
+ * @brief A Guard that acquires its resource on first use.
+ *
+ * Constructing a LazyGuard only stores how to create the resource. The first
+ * call to get() creates it and hands it to a Guard<T, FreePolicy>. A resource
+ * that was never created is never freed. This keeps resources that are set up
+ * at startup, but rarely used, off the startup path.
+ *
+ * makeLazyGuard() stores a call and its arguments and runs it through
+ * callChecked, so that a failed creation is reported by the ErrorPolicy (which
+ * must throw, since get() has no other way to report it):
+ *
+ *  auto rsa = makeLazyGuard<FreeWith<&RSA_free>, IsNotNullptrReturnCheckPolicy>(RSA_new);
+ *  ...
+ *  ct::callChecked(RSA_generate_key_ex, rsa.get(), 2048, exponent.get(), nullptr);
+ *
+ * With SingleThreadedInitPolicy (the default), get() must not be called
+ * concurrently. ThreadSafeInitPolicy allows for that. Moving a LazyGuard is
+ * never thread-safe.
+ */
+template <class T,
+          class FreePolicy,
+          class Create,
+          class InitPolicy = SingleThreadedInitPolicy>
+class LazyGuard : private _auxiliary::FreePolicyHolder<FreePolicy> {
+    static_assert(!std::is_reference<FreePolicy>::value, "The FreePolicy must not be a reference");
+
+    using _FreePolicyHolder = _auxiliary::FreePolicyHolder<FreePolicy>;
+
+public:
+    using GuardType = Guard<T, FreePolicy>;
+
+    explicit LazyGuard(Create create) : _FreePolicyHolder{}, _create{std::move(create)} {}
+
+    LazyGuard(Create create, FreePolicy func)
+            : _FreePolicyHolder{std::move(func)}, _create{std::move(create)} {}
+
+    LazyGuard(const LazyGuard &) = delete;
+    LazyGuard &operator=(const LazyGuard &) = delete;
+
+    LazyGuard(LazyGuard &&other);
+    LazyGuard &operator=(LazyGuard &&) = delete;
+
+    ~LazyGuard() noexcept(_auxiliary::IsNoexcept<FreePolicy>::value) {
+        if (_init.done()) {
+            _guard().~GuardType();
+        }
+    }
+
+    /**
+     * Create the resource, unless that has happened already, and return it.
+     */
+    T &get() {
+        if (!_init.done()) {
+            _init.once([this]() {
+                ::new (&_storage) GuardType{std::move(this->_freePolicy()), _create()};
+            });
+        }
+        return _guard().get();
+    }
+
+    bool created() const noexcept { return _init.done(); }
+
+private:
+    GuardType &_guard() noexcept { return *reinterpret_cast<GuardType *>(&_storage); }
+
+    Create _create;
+    InitPolicy _init{};
+    alignas(GuardType) unsigned char _storage[sizeof(GuardType)];
+};
+
+template <class T, class FreePolicy, class Create, class InitPolicy>
+LazyGuard<T, FreePolicy, Create, InitPolicy>::LazyGuard(LazyGuard &&other)
+        : _FreePolicyHolder{std::move(other._freePolicy())}, _create{std::move(other._create)} {
+    if (other._init.done()) {
+        ::new (&_storage) GuardType{std::move(other._guard())};
+        _init.setDone();
+    }
+}
+
+/**
+ * @brief Create a LazyGuard that runs a checked call to create its resource.
+ *
+ * The callable and the arguments are copied (or moved) into the LazyGuard, as
+ * with std::thread; use std::ref to pass references.
+ */
+template <class FreePolicy,
+          class ReturnCheckPolicy = DefaultReturnCheckPolicy,
+          class ErrorPolicy = DefaultErrorPolicy,
+          class InitPolicy = SingleThreadedInitPolicy,
+          class Callable,
+          class... Args>
+auto makeLazyGuard(Callable &&callable, Args &&... args) {
+    using Create = CheckedCreate<ReturnCheckPolicy, ErrorPolicy, std::decay_t<Callable>,
+                                 std::decay_t<Args>...>;
+    using T = std::decay_t<decltype(std::declval<Create &>()())>;
+    return LazyGuard<T, FreePolicy, Create, InitPolicy>{
+            Create{std::forward<Callable>(callable), std::forward<Args>(args)...}};
+}
+
+}  // namespace cppc
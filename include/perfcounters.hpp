@@ -0,0 +1,346 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "checkcall.hpp"
+#include "tracing.hpp"
+
+namespace cppc {
+
+/**
+ * @brief The performance counters read by a ProfilingCallCheckContext.
+ */
+enum class PerfCounter : unsigned { CYCLES, INSTRUCTIONS, CACHE_MISSES, BRANCH_MISSES, TASK_CLOCK };
+
+constexpr std::size_t NUM_PERF_COUNTERS{5};
+
+/**
+ * @brief Performance counter totals over a number of calls.
+ *
+ * Counters that could not be read (e.g., because the hardware PMU is not
+ * accessible) are not available and remain 0.
+ */
+struct PerfCounts {
+    std::array<std::uint64_t, NUM_PERF_COUNTERS> totals;
+    std::uint64_t calls;
+    unsigned availableMask;
+
+    bool available(PerfCounter counter) const noexcept {
+        return (availableMask & (1u << static_cast<unsigned>(counter))) != 0;
+    }
+
+    std::uint64_t operator[](PerfCounter counter) const noexcept {
+        return totals[static_cast<std::size_t>(counter)];
+    }
+
+    /**
+     * The average per call (0 if there were no calls).
+     */
+    double perCall(PerfCounter counter) const noexcept {
+        return calls == 0 ? 0.0 : static_cast<double>((*this)[counter]) / calls;
+    }
+
+    void merge(const PerfCounts &other) noexcept {
+        for (std::size_t i = 0; i < NUM_PERF_COUNTERS; i++) {
+            totals[i] += other.totals[i];
+        }
+        calls += other.calls;
+        availableMask |= other.availableMask;
+    }
+};
+
+/**
+ * @brief The performance counters of all call sites at some point in time.
+ *
+ * The counterpart of TraceSnapshot for ProfilingCallCheckContext, keyed by the
+ * same call sites.
+ */
+class PerfSnapshot {
+public:
+    using Sites = std::map<const void *, PerfCounts>;
+
+    const Sites &sites() const noexcept { return _sites; }
+
+    const PerfCounts *find(const void *site) const noexcept {
+        const auto it = _sites.find(site);
+        return it == _sites.end() ? nullptr : &it->second;
+    }
+
+    void merge(const void *site, const PerfCounts &counts) {
+        auto it = _sites.find(site);
+        if (it == _sites.end()) {
+            _sites.emplace(site, counts);
+            return;
+        }
+        it->second.merge(counts);
+    }
+
+    void merge(const PerfSnapshot &other) {
+        for (const auto &site : other._sites) {
+            merge(site.first, site.second);
+        }
+    }
+
+private:
+    Sites _sites{};
+};
+
+namespace _auxiliary {
+
+/**
+ * The performance counters of one call site in one thread, attached to its
+ * CallSiteCounters as their extension. Like those, only the owning thread
+ * writes them.
+ */
+class PerfCallSiteCounters : public CallSiteExtension {
+public:
+    static PerfCallSiteCounters &of(CallSiteCounters &counters) {
+        if (auto *extension = counters.extension()) {
+            return static_cast<PerfCallSiteCounters &>(*extension);
+        }
+        auto extension = std::make_unique<PerfCallSiteCounters>();
+        auto &perf = *extension;
+        counters.attach(std::move(extension));
+        return perf;
+    }
+
+    /**
+     * Record the difference of the performance counters before and after a call.
+     */
+    void record(const std::array<std::uint64_t, NUM_PERF_COUNTERS> &before,
+                const std::array<std::uint64_t, NUM_PERF_COUNTERS> &after,
+                unsigned availableMask) noexcept {
+        for (std::size_t i = 0; i < NUM_PERF_COUNTERS; i++) {
+            _add(_totals[i], after[i] - before[i]);
+        }
+        _add(_calls, 1);
+        _availableMask.store(availableMask, std::memory_order_relaxed);
+    }
+
+    PerfCounts counts() const noexcept {
+        PerfCounts counts{{}, _calls.load(std::memory_order_relaxed),
+                          _availableMask.load(std::memory_order_relaxed)};
+        for (std::size_t i = 0; i < NUM_PERF_COUNTERS; i++) {
+            counts.totals[i] = _totals[i].load(std::memory_order_relaxed);
+        }
+        return counts;
+    }
+
+    void merge(const CallSiteExtension &other) noexcept override {
+        const auto counts = static_cast<const PerfCallSiteCounters &>(other).counts();
+        for (std::size_t i = 0; i < NUM_PERF_COUNTERS; i++) {
+            _add(_totals[i], counts.totals[i]);
+        }
+        _add(_calls, counts.calls);
+        _availableMask.store(_availableMask.load(std::memory_order_relaxed) | counts.availableMask,
+                             std::memory_order_relaxed);
+    }
+
+private:
+    static void _add(std::atomic<std::uint64_t> &counter, std::uint64_t value) noexcept {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    std::array<std::atomic<std::uint64_t>, NUM_PERF_COUNTERS> _totals{};
+    std::atomic<std::uint64_t> _calls{0};
+    std::atomic<unsigned> _availableMask{0};
+};
+
+/**
+ * The performance counters of the current thread, opened as a single
+ * perf_event group, so that all of them are read with one syscall.
+ *
+ * Hardware counters are often unavailable (in containers and virtual
+ * machines, or if perf_event_paranoid forbids them). Such counters are
+ * skipped; the software task clock is used whenever the kernel permits it.
+ */
+class PerfEventGroup {
+public:
+    using Values = std::array<std::uint64_t, NUM_PERF_COUNTERS>;
+
+    static PerfEventGroup &local() {
+        thread_local PerfEventGroup group{};
+        return group;
+    }
+
+    PerfEventGroup(const PerfEventGroup &) = delete;
+    PerfEventGroup &operator=(const PerfEventGroup &) = delete;
+
+    ~PerfEventGroup() {
+        for (std::size_t i = 0; i < _numEvents; i++) {
+            ::close(_fds[i]);
+        }
+    }
+
+    /**
+     * A bit mask of the PerfCounters that are available.
+     */
+    unsigned availableMask() const noexcept { return _availableMask; }
+
+    /**
+     * Read the current values. Counters that are not available are 0.
+     */
+    void read(Values &values) const noexcept {
+        values.fill(0);
+        if (_numEvents == 0) {
+            return;
+        }
+        // see PERF_FORMAT_GROUP in perf_event_open(2)
+        std::uint64_t buffer[1 + NUM_PERF_COUNTERS];
+        if (::read(_fds[0], buffer, sizeof(buffer)) <= 0) {
+            return;
+        }
+        for (std::uint64_t i = 0; i < buffer[0] && i < _numEvents; i++) {
+            values[static_cast<std::size_t>(_counters[i])] = buffer[1 + i];
+        }
+    }
+
+private:
+    PerfEventGroup() {
+        _tryOpen(PerfCounter::CYCLES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        _tryOpen(PerfCounter::INSTRUCTIONS, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        _tryOpen(PerfCounter::CACHE_MISSES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+        _tryOpen(PerfCounter::BRANCH_MISSES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+        _tryOpen(PerfCounter::TASK_CLOCK, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK);
+    }
+
+    void _tryOpen(PerfCounter counter, std::uint32_t type, std::uint64_t config) noexcept {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.read_format = PERF_FORMAT_GROUP;
+        // counting user space only is permitted with the default perf_event_paranoid
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        const int groupFd{_numEvents == 0 ? -1 : _fds[0]};
+        const long fd{::syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0)};
+        if (fd < 0) {
+            return;
+        }
+        _fds[_numEvents] = static_cast<int>(fd);
+        _counters[_numEvents] = counter;
+        _numEvents++;
+        _availableMask |= 1u << static_cast<unsigned>(counter);
+    }
+
+    std::array<int, NUM_PERF_COUNTERS> _fds{};
+    std::array<PerfCounter, NUM_PERF_COUNTERS> _counters{};
+    std::size_t _numEvents{0};
+    unsigned _availableMask{0};
+};
+
+}  // namespace _auxiliary
+
+/**
+ * The performance counters of all call sites, summed over all threads
+ * (including those that have exited).
+ */
+inline PerfSnapshot perfSnapshot() {
+    PerfSnapshot snapshot{};
+    TraceRegistry::instance().visitExtensions(
+            [&snapshot](const void *site, const _auxiliary::CallSiteExtension &extension) {
+                snapshot.merge(site,
+                               static_cast<const _auxiliary::PerfCallSiteCounters &>(extension)
+                                       .counts());
+            });
+    return snapshot;
+}
+
+/**
+ * @brief A CallCheckContext that reads performance counters around every call.
+ *
+ * Like TracingCallCheckContext, this records latency and outcome of every
+ * call per call site. In addition, it reads cycles, instructions, cache misses
+ * and branch misses, as well as the task clock (in nanoseconds), before and
+ * after every call, and adds up the differences per call site (see
+ * perfSnapshot()). Counters that cannot be
+ * opened, e.g., hardware counters in a container, are reported as not
+ * available.
+ *
+ * Reading the counters costs two syscalls per call. This context is meant for
+ * finding calls that thrash the caches or mispredict branches, not for
+ * permanent instrumentation:
+ *
+ *  using ct = ProfilingCallCheckContext<IsNotZeroReturnCheckPolicy, OpenSSLErrorPolicy>;
+ *  ct::callChecked(BN_mod_exp, r, a, p, m, ctx);
+ *  ...
+ *  const auto *perf = perfSnapshot().find(reinterpret_cast<const void *>(&BN_mod_exp));
+ *  perf->perCall(PerfCounter::CACHE_MISSES);
+ *
+ * If CPPC_NO_TRACING is defined, nothing is recorded and the context compiles
+ * to exactly the same code as CallCheckContext.
+ */
+template <class ReturnCheckPolicy = DefaultReturnCheckPolicy,
+          class ErrorPolicy = DefaultErrorPolicy,
+          class Tag = void>
+class ProfilingCallCheckContext {
+public:
+    template <class Callable, class... Args>
+    static inline auto callChecked(Callable &&callable, Args &&... args) {
+#ifdef CPPC_NO_TRACING
+        return ::cppc::callChecked<ReturnCheckPolicy, ErrorPolicy>(
+                std::forward<Callable>(callable), std::forward<Args>(args)...);
+#else
+        using Clock = std::chrono::steady_clock;
+        using Rv = std::decay_t<decltype(callable(std::forward<Args>(args)...))>;
+        auto &counters = _auxiliary::CallSiteOf<Tag>::counters(callable);
+        auto &perf = _auxiliary::PerfCallSiteCounters::of(counters);
+        const auto &group = _auxiliary::PerfEventGroup::local();
+        auto call = [&counters, &perf, &group](Callable &c, Args &&... a) -> Rv {
+            _auxiliary::PerfEventGroup::Values before;
+            _auxiliary::PerfEventGroup::Values after;
+            group.read(before);
+            const auto start = Clock::now();
+            // opening and reading the counters may set errno, so reset it only now
+            _auxiliary::callPrecCallIfPresent<ReturnCheckPolicy>();
+            Rv rv = c(std::forward<Args>(a)...);
+            const auto nanos =
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start);
+            // reading the counters must not clobber errno for the ErrorPolicy
+            const int error{errno};
+            group.read(after);
+            errno = error;
+            counters.record(static_cast<std::uint64_t>(nanos.count()),
+                            ReturnCheckPolicy::returnValueIsOk(rv));
+            perf.record(before, after, group.availableMask());
+            return rv;
+        };
+        return _auxiliary::ReturnCheckWrapper<ReturnCheckPolicy, ErrorPolicy, Rv>::
+                callAndHandleReturnValue(call, callable, std::forward<Args>(args)...);
+#endif
+    }
+};
+
+}  // namespace cppc
@@ -0,0 +1,100 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#pragma once
+
+/*
+ * USDT (statically defined tracing) probes for perf, bpftrace and SystemTap.
+ *
+ * If <sys/sdt.h> is available, checked calls and Guards fire the following
+ * probes of provider "cppc":
+ *
+ *  call_entry(function)   before a checked call (function is the address of
+ *                         the called function, or 0 for function objects)
+ *  call_ok(rv)            after a call whose return value passed the check
+ *  call_fail(rv)          after a call whose return value failed the check,
+ *                         before the ErrorPolicy is invoked
+ *  guard_release(guard)   before a Guard frees what it guards (guard is the
+ *                         address of the Guard)
+ *
+ * Return values are passed as integers: integral and enum values as is,
+ * pointers as their address and everything else as 0. A probe compiles to a
+ * single nop (plus a note in the binary), unless a tracer attaches to it. E.g.:
+ *
+ *  bpftrace -e 'usdt:./server:cppc:call_fail { @[ustack] = count(); }'
+ *
+ * Without <sys/sdt.h>, or if CPPC_NO_PROBES is defined, the probes are
+ * compiled away.
+ */
+
+#include <cstdint>
+#include <type_traits>
+
+#if !defined(CPPC_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define CPPC_HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef CPPC_HAVE_PROBES
+#define CPPC_PROBE1(name, arg) DTRACE_PROBE1(cppc, name, arg)
+#else
+#define CPPC_PROBE1(name, arg) \
+    do {                       \
+    } while (0)
+#endif
+
+namespace cppc {
+
+namespace _auxiliary {
+
+template <class T, std::enable_if_t<std::is_integral<T>::value || std::is_enum<T>::value, int> = 0>
+inline std::int64_t probeValue(const T &t) noexcept {
+    return static_cast<std::int64_t>(t);
+}
+
+template <class T, std::enable_if_t<std::is_pointer<T>::value, int> = 0>
+inline std::int64_t probeValue(const T &t) noexcept {
+    return static_cast<std::int64_t>(reinterpret_cast<std::uintptr_t>(t));
+}
+
+template <class T,
+          std::enable_if_t<!std::is_integral<T>::value && !std::is_enum<T>::value &&
+                                   !std::is_pointer<T>::value,
+                           int> = 0>
+inline std::int64_t probeValue(const T &) noexcept {
+    return 0;
+}
+
+template <class Callable,
+          std::enable_if_t<std::is_function<std::remove_pointer_t<std::decay_t<Callable>>>::value,
+                           int> = 0>
+inline std::uintptr_t probeFunction(const Callable &callable) noexcept {
+    const std::decay_t<Callable> function{callable};
+    return reinterpret_cast<std::uintptr_t>(function);
+}
+
+template <class Callable,
+          std::enable_if_t<!std::is_function<std::remove_pointer_t<std::decay_t<Callable>>>::value,
+                           int> = 0>
+inline std::uintptr_t probeFunction(const Callable &) noexcept {
+    return 0;
+}
+
+}  // namespace _auxiliary
+
+}  // namespace cppc
@@ -0,0 +1,348 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "boundedqueue.hpp"
+#include "guard.hpp"
+
+namespace cppc {
+
+/**
+ * @brief A snapshot of the statistics of a ResourcePool.
+ */
+struct PoolStats {
+    // leases served from the current thread's cache
+    std::uint64_t cacheHits{0};
+    // leases served from the shared depot
+    std::uint64_t depotHits{0};
+    // leases that needed a new handle
+    std::uint64_t misses{0};
+    // handles destroyed because the depot was full or trimmed
+    std::uint64_t destroyed{0};
+
+    std::uint64_t hits() const noexcept { return cacheHits + depotHits; }
+};
+
+/**
+ * @brief A Reset hook for ResourcePools whose handles need no reset.
+ */
+struct NoReset {
+    template <class T>
+    void operator()(const T &) const noexcept {}
+};
+
+namespace _auxiliary {
+
+/**
+ * The FreePolicy of the leases of a ResourcePool.
+ */
+template <class Pool>
+struct ReturnToPool {
+    using ArgumentType = typename Pool::Handle;
+
+    void operator()(ArgumentType handle) const noexcept { Pool::instance()._release(handle); }
+
+    template <class H = ArgumentType, typename = std::enable_if_t<std::is_pointer<H>::value>>
+    static constexpr H nullValue() noexcept {
+        return nullptr;
+    }
+};
+
+}  // namespace _auxiliary
+
+/**
+ * @brief Recycles handles of a C API instead of creating and freeing them every time.
+ *
+ * acquire() returns a Guard (a lease) that, when destroyed, resets its handle
+ * and returns it to the pool, where it waits for the next call to acquire().
+ * Only if there is no handle to reuse, a new one is created:
+ *
+ *  using BignumPool = ResourcePool<BIGNUM *, Checked<&BN_new, IsNotNullptrReturnCheckPolicy>,
+ *                                  FreeWith<&BN_clear>, FreeWith<&BN_free>>;
+ *  auto exponent = BignumPool::instance().acquire();
+ *  ct::callChecked(BN_set_word, exponent.get(), 65537);
+ *
+ * Create, Reset and Destroy are stateless callables that create a handle
+ * (throwing if that fails), prepare a handle for reuse and free a handle. Reset
+ * and Destroy must not throw.
+ *
+ * Every thread keeps up to cacheSize idle handles, so that most leases do not
+ * synchronize with other threads at all. Beyond that, idle handles go to a
+ * lock-free depot shared by all threads, which holds at most depotCapacity
+ * handles. The high watermark lowers this limit: a handle that would push the
+ * depot beyond it is destroyed instead. trim() destroys idle handles down to
+ * the low watermark, and prewarm() creates handles ahead of time (e.g., at
+ * startup). When a thread exits, its idle handles go to the depot. If Destroy
+ * only frees memory (see OnlyFreesMemoryPolicy), the pool leaves its idle
+ * handles alone when it is destroyed after beginFastExit().
+ *
+ * There is one pool per combination of template arguments. A lease does not
+ * store a reference to the pool, so it is exactly as large as the handle if
+ * the handle is a pointer.
+ */
+template <class T,
+          class Create,
+          class Reset,
+          class Destroy,
+          std::size_t depotCapacity = 1024,
+          std::size_t cacheSize = 16>
+class ResourcePool {
+    static_assert(std::is_empty<Create>::value && std::is_empty<Reset>::value &&
+                          std::is_empty<Destroy>::value,
+                  "Create, Reset and Destroy must be stateless");
+    static_assert(cacheSize >= 2, "The per-thread cache must hold at least two handles");
+
+public:
+    using Handle = T;
+    using Lease = Guard<T, _auxiliary::ReturnToPool<ResourcePool>>;
+
+    static ResourcePool &instance() {
+        static ResourcePool pool{};
+        return pool;
+    }
+
+    ResourcePool(const ResourcePool &) = delete;
+    ResourcePool &operator=(const ResourcePool &) = delete;
+
+    ~ResourcePool() {
+        if (_auxiliary::skipsRelease(_auxiliary::OnlyFreesMemory<Destroy>{})) {
+            return;
+        }
+        T handle{};
+        while (_depot.tryPop(handle)) {
+            Destroy{}(handle);
+        }
+    }
+
+    Lease acquire();
+
+    /**
+     * Create up to count handles and put them into the depot, without exceeding
+     * the high watermark. Returns the number of handles created.
+     */
+    std::size_t prewarm(std::size_t count);
+
+    /**
+     * Destroy idle handles in the depot until at most the low watermark is
+     * left. Returns the number of handles destroyed.
+     */
+    std::size_t trim() noexcept;
+
+    /**
+     * Throws std::invalid_argument unless low <= high <= depotCapacity.
+     */
+    void setWatermarks(std::size_t low, std::size_t high);
+
+    /**
+     * The number of idle handles in the depot (not counting the per-thread
+     * caches).
+     */
+    std::size_t idle() const noexcept { return _depot.size(); }
+
+    PoolStats stats() const;
+
+private:
+    friend struct _auxiliary::ReturnToPool<ResourcePool>;
+
+    /**
+     * The idle handles of a thread. Only the owning thread modifies the cache,
+     * but other threads read the hit counter, hence the relaxed atomic.
+     */
+    struct _ThreadCache {
+        _ThreadCache() { instance()._register(this); }
+
+        _ThreadCache(const _ThreadCache &) = delete;
+        _ThreadCache &operator=(const _ThreadCache &) = delete;
+
+        ~_ThreadCache() {
+            _cacheGone() = true;
+            ResourcePool &pool{instance()};
+            while (count > 0) {
+                pool._toDepot(handles[--count]);
+            }
+            pool._unregister(this);
+        }
+
+        T handles[cacheSize]{};
+        std::size_t count{0};
+        std::atomic<std::uint64_t> hits{0};
+    };
+
+    ResourcePool() = default;
+
+    static _ThreadCache &_local() {
+        thread_local _ThreadCache cache{};
+        return cache;
+    }
+
+    /**
+     * Whether the current thread's cache has been destroyed (e.g., a Lease is
+     * released by a thread_local or static object that outlives the cache).
+     * Constant-initialized and trivially destructible, so that it outlives the
+     * cache.
+     */
+    static bool &_cacheGone() noexcept {
+        thread_local bool gone{false};
+        return gone;
+    }
+
+    void _release(T handle) noexcept;
+    void _toDepot(T handle) noexcept;
+
+    void _register(_ThreadCache *cache) {
+        std::lock_guard<std::mutex> lock{_cachesMutex};
+        _caches.push_back(cache);
+    }
+
+    void _unregister(_ThreadCache *cache) noexcept {
+        std::lock_guard<std::mutex> lock{_cachesMutex};
+        _exitedCacheHits += cache->hits.load(std::memory_order_relaxed);
+        _caches.erase(std::find(_caches.begin(), _caches.end(), cache));
+    }
+
+    BoundedMpmcQueue<T, depotCapacity> _depot{};
+    std::atomic<std::size_t> _lowWatermark{0};
+    std::atomic<std::size_t> _highWatermark{depotCapacity};
+
+    std::atomic<std::uint64_t> _depotHits{0};
+    std::atomic<std::uint64_t> _misses{0};
+    std::atomic<std::uint64_t> _destroyed{0};
+
+    // protects _caches and _exitedCacheHits
+    mutable std::mutex _cachesMutex{};
+    std::vector<_ThreadCache *> _caches{};
+    std::uint64_t _exitedCacheHits{0};
+};
+
+template <class T, class C, class R, class D, std::size_t depotCapacity, std::size_t cacheSize>
+auto ResourcePool<T, C, R, D, depotCapacity, cacheSize>::acquire() -> Lease {
+    T handle{};
+    if (_cacheGone()) {
+        if (_depot.tryPop(handle)) {
+            _depotHits.fetch_add(1, std::memory_order_relaxed);
+            return Lease{handle};
+        }
+        _misses.fetch_add(1, std::memory_order_relaxed);
+        return Lease{C{}()};
+    }
+    _ThreadCache &cache{_local()};
+    if (cache.count > 0) {
+        cache.hits.store(cache.hits.load(std::memory_order_relaxed) + 1,
+                         std::memory_order_relaxed);
+        return Lease{cache.handles[--cache.count]};
+    }
+    if (_depot.tryPop(handle)) {
+        _depotHits.fetch_add(1, std::memory_order_relaxed);
+        // refill half of the cache, so that the next leases do not touch the depot
+        while (cache.count < cacheSize / 2 && _depot.tryPop(cache.handles[cache.count])) {
+            cache.count++;
+        }
+        return Lease{handle};
+    }
+    _misses.fetch_add(1, std::memory_order_relaxed);
+    return Lease{C{}()};
+}
+
+template <class T, class C, class R, class D, std::size_t depotCapacity, std::size_t cacheSize>
+void ResourcePool<T, C, R, D, depotCapacity, cacheSize>::_release(T handle) noexcept {
+    R{}(handle);
+    if (_cacheGone()) {
+        _toDepot(handle);
+        return;
+    }
+    _ThreadCache &cache{_local()};
+    if (cache.count == cacheSize) {
+        // make room for the next cacheSize / 2 handles
+        for (std::size_t i = 0; i < cacheSize / 2; i++) {
+            _toDepot(cache.handles[--cache.count]);
+        }
+    }
+    cache.handles[cache.count++] = handle;
+}
+
+template <class T, class C, class R, class D, std::size_t depotCapacity, std::size_t cacheSize>
+void ResourcePool<T, C, R, D, depotCapacity, cacheSize>::_toDepot(T handle) noexcept {
+    if (_depot.size() >= _highWatermark.load(std::memory_order_relaxed) ||
+        !_depot.tryPush(handle)) {
+        D{}(handle);
+        _destroyed.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+template <class T, class C, class R, class D, std::size_t depotCapacity, std::size_t cacheSize>
+std::size_t ResourcePool<T, C, R, D, depotCapacity, cacheSize>::prewarm(std::size_t count) {
+    std::size_t created{0};
+    while (created < count && _depot.size() < _highWatermark.load(std::memory_order_relaxed)) {
+        T handle{C{}()};
+        if (!_depot.tryPush(handle)) {
+            D{}(handle);
+            break;
+        }
+        created++;
+    }
+    return created;
+}
+
+template <class T, class C, class R, class D, std::size_t depotCapacity, std::size_t cacheSize>
+std::size_t ResourcePool<T, C, R, D, depotCapacity, cacheSize>::trim() noexcept {
+    std::size_t trimmed{0};
+    T handle{};
+    while (_depot.size() > _lowWatermark.load(std::memory_order_relaxed) &&
+           _depot.tryPop(handle)) {
+        D{}(handle);
+        trimmed++;
+    }
+    _destroyed.fetch_add(trimmed, std::memory_order_relaxed);
+    return trimmed;
+}
+
+template <class T, class C, class R, class D, std::size_t depotCapacity, std::size_t cacheSize>
+void ResourcePool<T, C, R, D, depotCapacity, cacheSize>::setWatermarks(std::size_t low,
+                                                                       std::size_t high) {
+    if (low > high || high > depotCapacity) {
+        throw std::invalid_argument("Watermarks must satisfy low <= high <= depot capacity");
+    }
+    _lowWatermark.store(low, std::memory_order_relaxed);
+    _highWatermark.store(high, std::memory_order_relaxed);
+}
+
+template <class T, class C, class R, class D, std::size_t depotCapacity, std::size_t cacheSize>
+PoolStats ResourcePool<T, C, R, D, depotCapacity, cacheSize>::stats() const {
+    PoolStats stats{};
+    {
+        std::lock_guard<std::mutex> lock{_cachesMutex};
+        stats.cacheHits = _exitedCacheHits;
+        for (const _ThreadCache *cache : _caches) {
+            stats.cacheHits += cache->hits.load(std::memory_order_relaxed);
+        }
+    }
+    stats.depotHits = _depotHits.load(std::memory_order_relaxed);
+    stats.misses = _misses.load(std::memory_order_relaxed);
+    stats.destroyed = _destroyed.load(std::memory_order_relaxed);
+    return stats;
+}
+
+}  // namespace cppc
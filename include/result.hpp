@@ -0,0 +1,115 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include <cassert>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+namespace cppc {
+
+namespace _auxiliary {
+
+inline std::error_code toErrorCode(const std::error_code &ec) noexcept { return ec; }
+
+template <class E>
+inline std::error_code toErrorCode(E e) noexcept {
+    using std::make_error_code;
+    return make_error_code(e);
+}
+
+}  // namespace _auxiliary
+
+/**
+ * @brief Wraps an error, so that it can be converted to a Result.
+ *
+ * Use the helper function fail() to create a Failure.
+ */
+template <class E>
+struct Failure {
+    E error;
+};
+
+template <class E>
+constexpr Failure<std::decay_t<E>> fail(E &&e) {
+    return Failure<std::decay_t<E>>{std::forward<E>(e)};
+}
+
+/**
+ * @brief Either a value or an error.
+ *
+ * This is the return type of checked calls that report errors without
+ * throwing (see ExpectedErrorPolicy). Both the value and the error type must be
+ * trivially copyable. This is the case for the return types of C functions and
+ * makes the Result itself trivially copyable. A Result that is no larger than
+ * two registers (e.g., Result<int, std::errc> or Result<T *, std::errc>) is
+ * therefore returned in registers.
+ *
+ * Accessing the value of a failed Result (or the error of a successful one)
+ * is a programming error. It is caught by an assertion, not by an exception, so
+ * this class can be used in code compiled with -fno-exceptions.
+ */
+template <class T, class E = std::error_code>
+class Result {
+    static_assert(std::is_trivially_copyable<T>::value, "Value type must be trivially copyable");
+    static_assert(std::is_trivially_copyable<E>::value, "Error type must be trivially copyable");
+
+public:
+    using ValueType = T;
+    using ErrorType = E;
+
+    constexpr Result(const T &value) noexcept : _value{value}, _ok{true} {}
+
+    template <class F, typename = std::enable_if_t<std::is_convertible<F, E>::value>>
+    constexpr Result(const Failure<F> &failure) noexcept : _error{failure.error}, _ok{false} {}
+
+    constexpr bool ok() const noexcept { return _ok; }
+
+    constexpr explicit operator bool() const noexcept { return _ok; }
+
+    const T &value() const noexcept {
+        assert(_ok && "Result holds an error");
+        return _value;
+    }
+
+    template <class U>
+    constexpr T valueOr(U &&fallback) const noexcept {
+        return _ok ? _value : static_cast<T>(std::forward<U>(fallback));
+    }
+
+    const E &error() const noexcept {
+        assert(!_ok && "Result holds a value");
+        return _error;
+    }
+
+    /**
+     * The error as a std::error_code. Error types other than std::error_code
+     * are converted using make_error_code (e.g., std::errc yields an error_code
+     * in the generic category).
+     */
+    std::error_code errorCode() const noexcept { return _auxiliary::toErrorCode(error()); }
+
+private:
+    union {
+        T _value;
+        E _error;
+    };
+    bool _ok;
+};
+
+}  // namespace cppc
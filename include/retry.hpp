@@ -0,0 +1,204 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "checkcall.hpp"
+
+namespace cppc {
+
+namespace _auxiliary {
+
+constexpr bool isOneOf(int) noexcept { return false; }
+
+template <class... Ints>
+constexpr bool isOneOf(int value, int first, Ints... rest) noexcept {
+    return value == first || isOneOf(value, rest...);
+}
+
+/**
+ * Tell the CPU that we are spinning (to save power and free resources for a
+ * hyper-thread sibling).
+ */
+inline void cpuRelax() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+}  // namespace _auxiliary
+
+/**
+ * @brief Decides which failed calls are retried: those failing with one of the given errors.
+ *
+ * The error is obtained from the ErrorSource (see ExpectedErrorPolicy), so
+ * this works for functions reporting errors via errno as well as for those
+ * returning negated error codes:
+ *
+ *  RetryOnErrors<NegatedReturnValueErrorSource, EINTR>
+ */
+template <class ErrorSource, int... errors>
+struct RetryOnErrors {
+    template <class Rv>
+    static inline bool shouldRetry(const Rv& rv) noexcept {
+        return _auxiliary::isOneOf(static_cast<int>(ErrorSource::errorFrom(rv)), errors...);
+    }
+};
+
+/**
+ * Retry calls that fail with one of the given errno values, e.g., RetryOn<EINTR, EAGAIN>.
+ */
+template <int... errors>
+using RetryOn = RetryOnErrors<ErrnoErrorSource, errors...>;
+
+/**
+ * Retry right away.
+ */
+struct NoBackoff {
+    static inline void pause(unsigned) noexcept {}
+};
+
+/**
+ * Spin for the first `spins` retries, then yield the CPU before every retry.
+ */
+template <unsigned spins = 64>
+struct SpinThenYieldBackoff {
+    static inline void pause(unsigned retry) noexcept {
+        if (retry <= spins) {
+            _auxiliary::cpuRelax();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+};
+
+/**
+ * Sleep before every retry, starting with initialMicros microseconds and
+ * doubling the time with every retry, up to maxMicros.
+ */
+template <unsigned initialMicros = 1, unsigned maxMicros = 1000>
+struct ExponentialBackoff {
+    static_assert(initialMicros > 0 && initialMicros <= maxMicros, "Invalid backoff limits");
+
+    static inline void pause(unsigned retry) {
+        const std::uint64_t micros{std::min<std::uint64_t>(
+                std::uint64_t{initialMicros} << std::min(retry - 1, 31u), maxMicros)};
+        std::this_thread::sleep_for(std::chrono::microseconds{micros});
+    }
+};
+
+/**
+ * @brief Counts the retries of a RetryingCallCheckContext.
+ *
+ * The counters are only updated when a call is retried, so calls that succeed
+ * (or fail with an error that is not retried) on the first attempt do not
+ * touch them.
+ */
+class RetryStats {
+public:
+    /**
+     * The number of attempts beyond the first one, over all calls.
+     */
+    std::uint64_t retries() const noexcept { return _retries.load(std::memory_order_relaxed); }
+
+    /**
+     * The number of calls that were handed to the ErrorPolicy because they
+     * still failed with a retryable error after the maximum number of attempts.
+     */
+    std::uint64_t exhausted() const noexcept {
+        return _exhausted.load(std::memory_order_relaxed);
+    }
+
+    void reset() noexcept {
+        _retries.store(0, std::memory_order_relaxed);
+        _exhausted.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    template <class, class, class, class, unsigned>
+    friend class RetryingCallCheckContext;
+
+    std::atomic<std::uint64_t> _retries{0};
+    std::atomic<std::uint64_t> _exhausted{0};
+};
+
+/**
+ * @brief A CallCheckContext that retries calls failing with transient errors.
+ *
+ * A failed call (according to the ReturnCheckPolicy) is invoked again, in
+ * place and without throwing, as long as the RetryCondition says so and at
+ * most maxAttempts times in total (0 means no limit). The Backoff is applied
+ * before every retry, and the ReturnCheckPolicy's preCall (if any) runs before
+ * every attempt. Only the outcome of the last attempt reaches the ErrorPolicy:
+ *
+ *  using ct = RetryingCallCheckContext<RetryOn<EINTR>, IsNotNegativeReturnCheckPolicy,
+ *                                      ErrnoErrorPolicy>;
+ *  const auto bytesRead = ct::callChecked(read, fd, buf, sizeof(buf));
+ *
+ * Since a call may be made several times, the arguments are passed as
+ * lvalues to every attempt (i.e., they are not moved from).
+ */
+template <class RetryCondition,
+          class ReturnCheckPolicy = DefaultReturnCheckPolicy,
+          class ErrorPolicy = DefaultErrorPolicy,
+          class Backoff = NoBackoff,
+          unsigned maxAttempts = 0>
+class RetryingCallCheckContext {
+public:
+    template <class Callable, class... Args>
+    static inline auto callChecked(Callable&& callable, Args&&... args) {
+        using Rv = std::decay_t<decltype(callable(args...))>;
+        _auxiliary::callPrecCallIfPresent<ReturnCheckPolicy>();
+        auto call = [&callable](Args&... a) { return _callUntilDone<Rv>(callable, a...); };
+        return _auxiliary::ReturnCheckWrapper<ReturnCheckPolicy, ErrorPolicy, Rv>::
+                callAndHandleReturnValue(call, args...);
+    }
+
+    static RetryStats& stats() noexcept {
+        static RetryStats stats{};
+        return stats;
+    }
+
+private:
+    template <class Rv, class Callable, class... Args>
+    static Rv _callUntilDone(Callable& callable, Args&... args) {
+        for (unsigned attempt = 1;; attempt++) {
+            Rv rv = callable(args...);
+            if (ReturnCheckPolicy::returnValueIsOk(rv) || !RetryCondition::shouldRetry(rv)) {
+                return rv;
+            }
+            if (attempt == maxAttempts) {
+                stats()._exhausted.fetch_add(1, std::memory_order_relaxed);
+                return rv;
+            }
+            stats()._retries.fetch_add(1, std::memory_order_relaxed);
+            Backoff::pause(attempt);
+            _auxiliary::callPrecCallIfPresent<ReturnCheckPolicy>();
+        }
+    }
+};
+
+}  // namespace cppc
@@ -0,0 +1,338 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace cppc {
+
+namespace _auxiliary {
+
+/**
+ * A block of memory that is currently not in use. Free blocks form a
+ * singly-linked list.
+ */
+struct FreeBlock {
+    FreeBlock *next;
+};
+
+/**
+ * Owns the slabs of all SlabAllocators with the same block layout and keeps the
+ * free blocks of threads that have exited or hold too many of them.
+ *
+ * All functions lock a mutex, but they are only called when a thread needs a
+ * new slab, runs out of free blocks, has too many free blocks or exits.
+ */
+template <std::size_t BlockSize, std::size_t Alignment>
+class SlabDepot {
+public:
+    static constexpr std::size_t BLOCKS_PER_SLAB{64};
+
+    static SlabDepot &instance() {
+        static SlabDepot depot{};
+        return depot;
+    }
+
+    /**
+     * Allocate a new slab of BLOCKS_PER_SLAB blocks. The memory is owned by the
+     * depot and lives until the end of the program.
+     */
+    char *newSlab() {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _slabs.emplace_back(new _Slab);
+        return _slabs.back()->data;
+    }
+
+    /**
+     * Take all free blocks that threads have returned when exiting.
+     */
+    FreeBlock *takeFreeBlocks() {
+        std::lock_guard<std::mutex> lock{_mutex};
+        FreeBlock *blocks{_freeBlocks};
+        _freeBlocks = nullptr;
+        return blocks;
+    }
+
+    /**
+     * Allocate a single block. Used by threads whose SlabAllocator has already
+     * been destroyed.
+     */
+    void *allocateBlock() {
+        std::lock_guard<std::mutex> lock{_mutex};
+        if (_freeBlocks == nullptr) {
+            _slabs.emplace_back(new _Slab);
+            char *data{_slabs.back()->data};
+            for (std::size_t i = BLOCKS_PER_SLAB; i-- > 0;) {
+                _freeBlocks = ::new (data + i * BlockSize) FreeBlock{_freeBlocks};
+            }
+        }
+        FreeBlock *block{_freeBlocks};
+        _freeBlocks = block->next;
+        return block;
+    }
+
+    void returnFreeBlocks(FreeBlock *first, FreeBlock *last) {
+        std::lock_guard<std::mutex> lock{_mutex};
+        last->next = _freeBlocks;
+        _freeBlocks = first;
+    }
+
+    /**
+     * The number of slabs allocated so far.
+     */
+    std::size_t numSlabs() const {
+        std::lock_guard<std::mutex> lock{_mutex};
+        return _slabs.size();
+    }
+
+private:
+    struct _Slab {
+        alignas(Alignment) char data[BlockSize * BLOCKS_PER_SLAB];
+    };
+
+    SlabDepot() = default;
+
+    mutable std::mutex _mutex{};
+    std::vector<std::unique_ptr<_Slab>> _slabs{};
+    FreeBlock *_freeBlocks{nullptr};
+};
+
+/**
+ * @brief A per-thread allocator of fixed-size blocks.
+ *
+ * Blocks are carved from slabs (see SlabDepot) and freed blocks are kept in a
+ * per-thread free list. Both allocation and deallocation are O(1) and do not
+ * synchronize with other threads, except when a new slab is needed.
+ *
+ * A block may be deallocated by a different thread than the one that allocated
+ * it. It is then reused by the deallocating thread. A thread keeps at most
+ * MAX_FREE_BLOCKS free blocks: beyond that, half of them go back to the
+ * SlabDepot, where threads that run out of blocks find them. So if one thread
+ * allocates and another deallocates, the blocks circulate between them instead
+ * of piling up on the deallocating thread. When a thread exits, its free
+ * blocks are handed back to the SlabDepot as well.
+ */
+template <std::size_t BlockSize, std::size_t Alignment>
+class SlabAllocator {
+    static_assert(BlockSize >= sizeof(FreeBlock), "Blocks must be able to hold a FreeBlock");
+    static_assert(BlockSize % Alignment == 0, "BlockSize must be a multiple of the alignment");
+    static_assert(Alignment >= alignof(FreeBlock), "Blocks must be aligned for a FreeBlock");
+
+public:
+    using Depot = SlabDepot<BlockSize, Alignment>;
+
+    static constexpr std::size_t MAX_FREE_BLOCKS{2 * Depot::BLOCKS_PER_SLAB};
+
+    static SlabAllocator &local() {
+        thread_local SlabAllocator allocator{};
+        return allocator;
+    }
+
+    /**
+     * Allocate a block from the current thread's allocator or, if that has
+     * been destroyed (e.g., while other thread-local or static objects are
+     * destroyed), from the depot.
+     */
+    static void *allocateBlock() {
+        if (_destroyed()) {
+            return Depot::instance().allocateBlock();
+        }
+        return local().allocate();
+    }
+
+    /**
+     * Return a block to the current thread's allocator or, if that has been
+     * destroyed, to the depot.
+     */
+    static void deallocateBlock(void *ptr) noexcept {
+        if (_destroyed()) {
+            FreeBlock *block{::new (ptr) FreeBlock{nullptr}};
+            Depot::instance().returnFreeBlocks(block, block);
+            return;
+        }
+        local().deallocate(ptr);
+    }
+
+    SlabAllocator(const SlabAllocator &) = delete;
+    SlabAllocator &operator=(const SlabAllocator &) = delete;
+
+    ~SlabAllocator() {
+        _destroyed() = true;
+        if (_freeBlocks != nullptr) {
+            FreeBlock *last{_freeBlocks};
+            while (last->next != nullptr) {
+                last = last->next;
+            }
+            Depot::instance().returnFreeBlocks(_freeBlocks, last);
+        }
+    }
+
+    void *allocate() {
+        if (_freeBlocks == nullptr) {
+            if (_next != _end) {
+                void *block{_next};
+                _next += BlockSize;
+                return block;
+            }
+            _freeBlocks = Depot::instance().takeFreeBlocks();
+            _numFreeBlocks = _count(_freeBlocks);
+            if (_freeBlocks == nullptr) {
+                _next = Depot::instance().newSlab();
+                _end = _next + BlockSize * Depot::BLOCKS_PER_SLAB;
+                return allocate();
+            }
+        }
+        FreeBlock *block{_freeBlocks};
+        _freeBlocks = block->next;
+        _numFreeBlocks--;
+        return block;
+    }
+
+    void deallocate(void *ptr) noexcept {
+        FreeBlock *block{::new (ptr) FreeBlock{_freeBlocks}};
+        _freeBlocks = block;
+        if (++_numFreeBlocks > MAX_FREE_BLOCKS) {
+            _returnHalf();
+        }
+    }
+
+private:
+    SlabAllocator() = default;
+
+    /**
+     * Whether the current thread's allocator has been destroyed. Constant-
+     * initialized and trivially destructible, so that it outlives the allocator.
+     */
+    static bool &_destroyed() noexcept {
+        thread_local bool destroyed{false};
+        return destroyed;
+    }
+
+    static std::size_t _count(const FreeBlock *blocks) noexcept {
+        std::size_t count{0};
+        for (; blocks != nullptr; blocks = blocks->next) {
+            count++;
+        }
+        return count;
+    }
+
+    /**
+     * Keep the most recently freed half of the free blocks (which are likely
+     * still cached) and hand the other half to the depot.
+     */
+    void _returnHalf() noexcept {
+        FreeBlock *lastKept{_freeBlocks};
+        for (std::size_t i = 1; i < _numFreeBlocks / 2; i++) {
+            lastKept = lastKept->next;
+        }
+        FreeBlock *first{lastKept->next};
+        FreeBlock *last{first};
+        while (last->next != nullptr) {
+            last = last->next;
+        }
+        lastKept->next = nullptr;
+        Depot::instance().returnFreeBlocks(first, last);
+        _numFreeBlocks /= 2;
+    }
+
+    FreeBlock *_freeBlocks{nullptr};
+    std::size_t _numFreeBlocks{0};
+    char *_next{nullptr};
+    char *_end{nullptr};
+};
+
+/**
+ * The block layout used to store objects of type T.
+ */
+template <class T>
+struct SlabBlockLayout {
+    static constexpr std::size_t alignment{alignof(T) > alignof(FreeBlock) ? alignof(T)
+                                                                            : alignof(FreeBlock)};
+    static constexpr std::size_t size{
+            ((sizeof(T) > sizeof(FreeBlock) ? sizeof(T) : sizeof(FreeBlock)) + alignment - 1) /
+            alignment * alignment};
+};
+
+template <class T>
+using SlabAllocatorFor =
+        SlabAllocator<SlabBlockLayout<T>::size, SlabBlockLayout<T>::alignment>;
+
+}  // namespace _auxiliary
+
+/**
+ * @brief Destroys an object and returns its memory to the current thread's SlabAllocator.
+ */
+template <class T>
+struct SlabDeleter {
+    void operator()(T *t) const noexcept {
+        t->~T();
+        _auxiliary::SlabAllocatorFor<T>::deallocateBlock(t);
+    }
+};
+
+/**
+ * @brief A StoragePolicy that stores the guarded object in memory from a per-thread slab
+ * allocator.
+ *
+ * Like UniquePointerStoragePolicy, this policy gives the guarded object a
+ * stable address (e.g., for C APIs that initialize a struct in place and keep
+ * pointers to it). But instead of calling operator new for every Guard, it
+ * takes fixed-size blocks from a per-thread free list, which is refilled from
+ * slabs of 64 blocks. Blocks are reused by all Guards whose types have the same
+ * size and alignment.
+ */
+template <class T>
+struct PooledStoragePolicy {
+    using RawType = std::remove_reference_t<T>;
+    using StorageType = std::unique_ptr<RawType, SlabDeleter<RawType>>;
+
+    static_assert(alignof(RawType) <= alignof(std::max_align_t), "Type is over-aligned");
+
+    inline static std::add_lvalue_reference_t<const RawType> getFrom(
+            const StorageType &t) noexcept {
+        return *t;
+    }
+
+    inline static std::add_lvalue_reference_t<RawType> getFrom(StorageType &t) noexcept {
+        return *t;
+    }
+
+    template <class... Args>
+    inline static StorageType createFrom(Args &&... args) {
+        // give the block back if the constructor throws
+        std::unique_ptr<void, _ReturnBlock> block{
+                _auxiliary::SlabAllocatorFor<RawType>::allocateBlock()};
+        StorageType t{::new (block.get()) RawType(std::forward<Args>(args)...)};
+        block.release();
+        return t;
+    }
+
+private:
+    struct _ReturnBlock {
+        void operator()(void *block) const noexcept {
+            _auxiliary::SlabAllocatorFor<RawType>::deallocateBlock(block);
+        }
+    };
+};
+
+}  // namespace cppc
@@ -0,0 +1,349 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+ * On x86, the status array checks scan their input with AVX2 or SSE2, whichever
+ * the CPU running the program supports, and fall back to a scalar loop
+ * otherwise. The SIMD code is compiled for its instruction set with
+ * __attribute__((target)), so every translation unit sees the same definitions,
+ * whatever instruction sets it is compiled for. Define CPPC_NO_SIMD (for the
+ * whole program) to always use the scalar loop.
+ */
+#if !defined(CPPC_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CPPC_STATUS_ARRAY_SIMD
+#endif
+
+namespace cppc {
+
+/**
+ * @brief A view of a contiguous array of status codes, as returned by C APIs
+ * that process several items at once (think recvmmsg, poll or io_uring
+ * completions).
+ *
+ * Status arrays are checked by AllNotNegativeReturnCheckPolicy or
+ * AllZeroReturnCheckPolicy, which scan the whole array with SIMD instructions.
+ */
+template <class T>
+class StatusArray {
+    static_assert(std::is_integral<T>::value, "Status codes must be integral");
+
+public:
+    constexpr StatusArray(const T *data, std::size_t size) noexcept : _data{data}, _size{size} {}
+
+    template <class Container,
+              typename = std::enable_if_t<std::is_same<
+                      std::decay_t<decltype(*std::declval<const Container &>().data())>,
+                      T>::value>>
+    constexpr StatusArray(const Container &container) noexcept
+            : _data{container.data()}, _size{container.size()} {}
+
+    constexpr const T *data() const noexcept { return _data; }
+    constexpr std::size_t size() const noexcept { return _size; }
+    constexpr const T &operator[](std::size_t i) const noexcept { return _data[i]; }
+    constexpr const T *begin() const noexcept { return _data; }
+    constexpr const T *end() const noexcept { return _data + _size; }
+
+private:
+    const T *_data;
+    std::size_t _size;
+};
+
+template <class T>
+constexpr StatusArray<T> statusArray(const T *data, std::size_t size) noexcept {
+    return StatusArray<T>{data, size};
+}
+
+namespace _auxiliary {
+
+struct NegativeCheck {
+    template <class T>
+    static inline bool isFailure(T status) noexcept {
+        static_assert(std::is_signed<T>::value, "Must be a signed type");
+        return status < 0;
+    }
+};
+
+struct NonZeroCheck {
+    template <class T>
+    static inline bool isFailure(T status) noexcept {
+        return status != 0;
+    }
+};
+
+/**
+ * The signed integer type of the same size as T, if the SIMD code supports T.
+ */
+template <class T>
+using SimdLaneType = std::conditional_t<
+        std::is_integral<T>::value && sizeof(T) == sizeof(std::int32_t),
+        std::int32_t,
+        std::conditional_t<std::is_integral<T>::value && sizeof(T) == sizeof(std::int64_t),
+                           std::int64_t,
+                           void>>;
+
+template <class Check, class T>
+inline std::size_t firstFailure(const T *data,
+                                std::size_t begin,
+                                std::size_t size,
+                                std::false_type) noexcept {
+    for (std::size_t i = begin; i < size; i++) {
+        if (Check::isFailure(data[i])) {
+            return i;
+        }
+    }
+    return size;
+}
+
+#if defined(CPPC_STATUS_ARRAY_SIMD)
+/*
+ * The SIMD scans process blocks of four vectors. Both checks can be applied to
+ * the bitwise or of all vectors in a block (a status code is negative if its
+ * sign bit is set and non-zero if any bit is set), so there is only one branch
+ * per block. The first failure within a failing block is then found by the
+ * scalar loop, as is the first failure in the remaining tail.
+ */
+constexpr std::size_t SIMD_VECTORS_PER_BLOCK{4};
+
+__attribute__((target("avx2"))) inline bool hasFailureAvx2(NegativeCheck,
+                                                           __m256i v,
+                                                           std::int32_t) noexcept {
+    return _mm256_movemask_ps(_mm256_castsi256_ps(v)) != 0;
+}
+
+__attribute__((target("avx2"))) inline bool hasFailureAvx2(NegativeCheck,
+                                                           __m256i v,
+                                                           std::int64_t) noexcept {
+    return _mm256_movemask_pd(_mm256_castsi256_pd(v)) != 0;
+}
+
+template <class Lane>
+__attribute__((target("avx2"))) inline bool hasFailureAvx2(NonZeroCheck,
+                                                           __m256i v,
+                                                           Lane) noexcept {
+    return !_mm256_testz_si256(v, v);
+}
+
+template <class Check, class T>
+__attribute__((target("avx2"))) inline std::size_t firstFailureAvx2(const T *data,
+                                                                    std::size_t begin,
+                                                                    std::size_t size) noexcept {
+    constexpr std::size_t vectorSize{sizeof(__m256i) / sizeof(T)};
+    constexpr std::size_t blockSize{SIMD_VECTORS_PER_BLOCK * vectorSize};
+    std::size_t i{begin};
+    for (; i + blockSize <= size; i += blockSize) {
+        const T *block{data + i};
+        __m256i combined{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(block))};
+        for (std::size_t v = 1; v < SIMD_VECTORS_PER_BLOCK; v++) {
+            combined = _mm256_or_si256(
+                    combined,
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block + v * vectorSize)));
+        }
+        if (hasFailureAvx2(Check{}, combined, SimdLaneType<T>{})) {
+            return firstFailure<Check>(data, i, i + blockSize, std::false_type{});
+        }
+    }
+    return firstFailure<Check>(data, i, size, std::false_type{});
+}
+
+__attribute__((target("sse2"))) inline bool hasFailureSse2(NegativeCheck,
+                                                           __m128i v,
+                                                           std::int32_t) noexcept {
+    return _mm_movemask_ps(_mm_castsi128_ps(v)) != 0;
+}
+
+__attribute__((target("sse2"))) inline bool hasFailureSse2(NegativeCheck,
+                                                           __m128i v,
+                                                           std::int64_t) noexcept {
+    return _mm_movemask_pd(_mm_castsi128_pd(v)) != 0;
+}
+
+template <class Lane>
+__attribute__((target("sse2"))) inline bool hasFailureSse2(NonZeroCheck,
+                                                           __m128i v,
+                                                           Lane) noexcept {
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xffff;
+}
+
+template <class Check, class T>
+__attribute__((target("sse2"))) inline std::size_t firstFailureSse2(const T *data,
+                                                                    std::size_t begin,
+                                                                    std::size_t size) noexcept {
+    constexpr std::size_t vectorSize{sizeof(__m128i) / sizeof(T)};
+    constexpr std::size_t blockSize{SIMD_VECTORS_PER_BLOCK * vectorSize};
+    std::size_t i{begin};
+    for (; i + blockSize <= size; i += blockSize) {
+        const T *block{data + i};
+        __m128i combined{_mm_loadu_si128(reinterpret_cast<const __m128i *>(block))};
+        for (std::size_t v = 1; v < SIMD_VECTORS_PER_BLOCK; v++) {
+            combined = _mm_or_si128(
+                    combined,
+                    _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + v * vectorSize)));
+        }
+        if (hasFailureSse2(Check{}, combined, SimdLaneType<T>{})) {
+            return firstFailure<Check>(data, i, i + blockSize, std::false_type{});
+        }
+    }
+    return firstFailure<Check>(data, i, size, std::false_type{});
+}
+
+enum class SimdLevel { NONE, SSE2, AVX2 };
+
+/**
+ * The best instruction set supported by the CPU, determined once.
+ */
+inline SimdLevel simdLevel() noexcept {
+    static const SimdLevel level{[]() {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return SimdLevel::AVX2;
+        }
+        return __builtin_cpu_supports("sse2") ? SimdLevel::SSE2 : SimdLevel::NONE;
+    }()};
+    return level;
+}
+
+template <class Check, class T>
+inline std::size_t firstFailure(const T *data,
+                                std::size_t begin,
+                                std::size_t size,
+                                std::true_type) noexcept {
+    switch (simdLevel()) {
+        case SimdLevel::AVX2:
+            return firstFailureAvx2<Check>(data, begin, size);
+        case SimdLevel::SSE2:
+            return firstFailureSse2<Check>(data, begin, size);
+        default:
+            return firstFailure<Check>(data, begin, size, std::false_type{});
+    }
+}
+
+template <class T>
+using UsesSimd = std::integral_constant<bool, !std::is_void<SimdLaneType<T>>::value>;
+#else
+template <class T>
+using UsesSimd = std::false_type;
+#endif
+
+/**
+ * Find the index of the first status code in [begin, size) that fails the
+ * check, or size if there is none.
+ */
+template <class Check, class T>
+inline std::size_t firstFailure(const T *data, std::size_t begin, std::size_t size) noexcept {
+    return firstFailure<Check>(data, begin, size, UsesSimd<T>{});
+}
+
+template <class ElementCheck>
+struct AllReturnCheckPolicy {
+    using Check = ElementCheck;
+
+    template <class T>
+    static inline bool returnValueIsOk(const StatusArray<T> &statuses) noexcept {
+        return firstFailure<Check>(statuses.data(), 0, statuses.size()) == statuses.size();
+    }
+};
+
+}  // namespace _auxiliary
+
+/**
+ * @brief Checks that no status code in a StatusArray is negative.
+ */
+struct AllNotNegativeReturnCheckPolicy
+        : public _auxiliary::AllReturnCheckPolicy<_auxiliary::NegativeCheck> {};
+
+/**
+ * @brief Checks that all status codes in a StatusArray are zero.
+ */
+struct AllZeroReturnCheckPolicy
+        : public _auxiliary::AllReturnCheckPolicy<_auxiliary::NonZeroCheck> {};
+
+/**
+ * @brief The index of the first status code at or after 'from' that fails
+ * the ReturnCheckPolicy, or statuses.size() if there is none.
+ */
+template <class ReturnCheckPolicy, class T>
+inline std::size_t firstFailureIndex(const StatusArray<T> &statuses,
+                                     std::size_t from = 0) noexcept {
+    return _auxiliary::firstFailure<typename ReturnCheckPolicy::Check>(statuses.data(), from,
+                                                                       statuses.size());
+}
+
+/**
+ * @brief The indices of all status codes that fail the ReturnCheckPolicy.
+ */
+template <class ReturnCheckPolicy, class T>
+inline std::vector<std::size_t> failingIndices(const StatusArray<T> &statuses) {
+    std::vector<std::size_t> indices{};
+    for (std::size_t i = firstFailureIndex<ReturnCheckPolicy>(statuses); i < statuses.size();
+         i = firstFailureIndex<ReturnCheckPolicy>(statuses, i + 1)) {
+        indices.push_back(i);
+    }
+    return indices;
+}
+
+/**
+ * @brief Exception reporting which status codes in a StatusArray indicated an error.
+ */
+class StatusArrayError : public std::runtime_error {
+public:
+    StatusArrayError(std::vector<std::size_t> failingIndices, std::size_t size)
+            : std::runtime_error{""}, _failingIndices{std::move(failingIndices)}, _size{size} {}
+
+    const std::vector<std::size_t> &failingIndices() const noexcept { return _failingIndices; }
+
+    const char *what() const noexcept override {
+        if (!_formatted) {
+            std::snprintf(_message, sizeof(_message), "%zu of %zu status codes indicated error",
+                          _failingIndices.size(), _size);
+            _formatted = true;
+        }
+        return _message;
+    }
+
+private:
+    std::vector<std::size_t> _failingIndices;
+    std::size_t _size;
+    mutable bool _formatted{false};
+    mutable char _message[64];
+};
+
+/**
+ * @brief Throws a StatusArrayError with the indices of the status codes that
+ * fail the ReturnCheckPolicy.
+ *
+ *  using ct = CallCheckContext<AllZeroReturnCheckPolicy,
+ *                              ReportFailingIndicesErrorPolicy<AllZeroReturnCheckPolicy>>;
+ */
+template <class ReturnCheckPolicy>
+struct ReportFailingIndicesErrorPolicy {
+    template <class T>
+    static void handleError(const StatusArray<T> &statuses) {
+        throw StatusArrayError{failingIndices<ReturnCheckPolicy>(statuses), statuses.size()};
+    }
+};
+
+}  // namespace cppc
@@ -0,0 +1,173 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#include "guard.hpp"
+
+namespace cppc {
+
+/**
+ * @brief One lazily created resource per thread, freed by a Guard when the thread exits.
+ *
+ * Many C libraries need a scratch context per thread (e.g., a BN_CTX, a
+ * z_stream or a regex match buffer). get() returns the calling thread's
+ * instance. The first call in every thread creates the resource with Create,
+ * a stateless callable that returns the handle (or throws). The handle is held
+ * by a Guard<T, Free>, which frees it when the thread exits:
+ *
+ *  using BnCtx = ThreadLocalGuard<BN_CTX *, BnCtxCreate, FreeWith<&BN_CTX_free>>;
+ *  ct::callChecked(BN_mod_exp, result, base, exponent, modulus, BnCtx::get());
+ *
+ * Once the resource exists, get() is a check of a thread-local flag; it does
+ * not lock. Creating and freeing a resource locks a mutex, since all live
+ * instances are registered, so that forEach() can enumerate them and
+ * shutdown() can free them deterministically, e.g., before the process exits
+ * while other threads are still around. Neither must run while another thread
+ * uses its instance. A thread that calls get() after shutdown() gets a new
+ * instance.
+ *
+ * There is one set of instances per combination of template arguments. Tag
+ * allows for several with the same handle type and policies.
+ */
+template <class T, class Create, class Free, class Tag = void>
+class ThreadLocalGuard {
+    static_assert(std::is_empty<Create>::value, "Create must be stateless");
+
+public:
+    using GuardType = Guard<T, Free>;
+
+    ThreadLocalGuard() = delete;
+
+    static T &get() {
+        _Slot &slot{_local()};
+        if (slot.live.load(std::memory_order_acquire)) {
+            return slot.guard().get();
+        }
+        return _create(slot);
+    }
+
+    /**
+     * Whether the calling thread has a live instance.
+     */
+    static bool exists() noexcept { return _local().live.load(std::memory_order_acquire); }
+
+    /**
+     * Call f with every live instance (of all threads).
+     */
+    template <class F>
+    static void forEach(F &&f) {
+        _Registry &registry{_registry()};
+        std::lock_guard<std::mutex> lock{registry.mutex};
+        for (_Slot *slot : registry.slots) {
+            f(slot->guard().get());
+        }
+    }
+
+    /**
+     * The number of live instances.
+     */
+    static std::size_t size() {
+        _Registry &registry{_registry()};
+        std::lock_guard<std::mutex> lock{registry.mutex};
+        return registry.slots.size();
+    }
+
+    /**
+     * Free all live instances now. Returns the number of instances freed.
+     */
+    static std::size_t shutdown() noexcept(_auxiliary::IsNoexcept<Free>::value) {
+        _Registry &registry{_registry()};
+        std::lock_guard<std::mutex> lock{registry.mutex};
+        const std::size_t freed{registry.slots.size()};
+        for (_Slot *slot : registry.slots) {
+            slot->destroy();
+        }
+        registry.slots.clear();
+        return freed;
+    }
+
+private:
+    /**
+     * The Guard of a thread, if it has been created. Guards are only created
+     * by the owning thread, but they are destroyed with the registry's mutex
+     * held, either on thread exit or by shutdown().
+     */
+    struct _Slot {
+        _Slot() = default;
+        _Slot(const _Slot &) = delete;
+        _Slot &operator=(const _Slot &) = delete;
+
+        ~_Slot() {
+            _Registry &registry{_registry()};
+            std::lock_guard<std::mutex> lock{registry.mutex};
+            if (live.load(std::memory_order_relaxed)) {
+                registry.slots.erase(
+                        std::find(registry.slots.begin(), registry.slots.end(), this));
+                destroy();
+            }
+        }
+
+        GuardType &guard() noexcept { return *reinterpret_cast<GuardType *>(&storage); }
+
+        void destroy() noexcept(_auxiliary::IsNoexcept<Free>::value) {
+            live.store(false, std::memory_order_relaxed);
+            guard().~GuardType();
+        }
+
+        std::atomic<bool> live{false};
+        alignas(GuardType) unsigned char storage[sizeof(GuardType)];
+    };
+
+    struct _Registry {
+        std::mutex mutex{};
+        std::vector<_Slot *> slots{};
+    };
+
+    static _Registry &_registry() {
+        static _Registry registry{};
+        return registry;
+    }
+
+    static _Slot &_local() noexcept {
+        thread_local _Slot slot{};
+        return slot;
+    }
+
+    static T &_create(_Slot &slot);
+};
+
+template <class T, class Create, class Free, class Tag>
+T &ThreadLocalGuard<T, Create, Free, Tag>::_create(_Slot &slot) {
+    _Registry &registry{_registry()};
+    GuardType guard{Create{}()};
+    std::lock_guard<std::mutex> lock{registry.mutex};
+    registry.slots.reserve(registry.slots.size() + 1);
+    ::new (&slot.storage) GuardType{std::move(guard)};
+    registry.slots.push_back(&slot);
+    slot.live.store(true, std::memory_order_release);
+    return slot.guard().get();
+}
+
+}  // namespace cppc
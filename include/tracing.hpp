@@ -0,0 +1,526 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "checkcall.hpp"
+
+namespace cppc {
+
+/**
+ * @brief A log-linear histogram of latencies (in nanoseconds).
+ *
+ * Values below 2^SUB_BUCKET_BITS have a bucket each. Above, every power of two
+ * is split into 2^SUB_BUCKET_BITS equally sized buckets, so a value is known up
+ * to 1/2^SUB_BUCKET_BITS (12.5%) of its magnitude. This covers the whole range
+ * of std::uint64_t with NUM_BUCKETS buckets.
+ */
+class LatencyHistogram {
+public:
+    static constexpr unsigned SUB_BUCKET_BITS{3};
+    static constexpr std::size_t SUB_BUCKETS{std::size_t{1} << SUB_BUCKET_BITS};
+    static constexpr std::size_t NUM_BUCKETS{(64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS};
+
+    static std::size_t bucketOf(std::uint64_t value) noexcept {
+        if (value < SUB_BUCKETS) {
+            return static_cast<std::size_t>(value);
+        }
+        const unsigned shift{63u - static_cast<unsigned>(__builtin_clzll(value)) -
+                             SUB_BUCKET_BITS};
+        return (shift + 1) * SUB_BUCKETS + static_cast<std::size_t>(value >> shift) - SUB_BUCKETS;
+    }
+
+    /**
+     * The smallest value that falls into the bucket.
+     */
+    static std::uint64_t lowerBound(std::size_t bucket) noexcept {
+        if (bucket < SUB_BUCKETS) {
+            return bucket;
+        }
+        const std::size_t shift{bucket / SUB_BUCKETS - 1};
+        return std::uint64_t{bucket % SUB_BUCKETS + SUB_BUCKETS} << shift;
+    }
+
+    void record(std::uint64_t value, std::uint64_t count = 1) noexcept {
+        _buckets[bucketOf(value)] += count;
+    }
+
+    void merge(const LatencyHistogram &other) noexcept {
+        for (std::size_t i = 0; i < NUM_BUCKETS; i++) {
+            _buckets[i] += other._buckets[i];
+        }
+    }
+
+    std::uint64_t bucketCount(std::size_t bucket) const noexcept { return _buckets[bucket]; }
+
+    std::uint64_t count() const noexcept {
+        std::uint64_t total{0};
+        for (const auto c : _buckets) {
+            total += c;
+        }
+        return total;
+    }
+
+    /**
+     * The lower bound of the bucket holding the value at the given quantile
+     * (between 0 and 1). Returns 0 for an empty histogram.
+     */
+    std::uint64_t percentile(double quantile) const noexcept {
+        const std::uint64_t total{count()};
+        if (total == 0) {
+            return 0;
+        }
+        const auto rank = static_cast<std::uint64_t>(quantile * static_cast<double>(total - 1));
+        std::uint64_t seen{0};
+        for (std::size_t i = 0; i < NUM_BUCKETS; i++) {
+            seen += _buckets[i];
+            if (seen > rank) {
+                return lowerBound(i);
+            }
+        }
+        return lowerBound(NUM_BUCKETS - 1);
+    }
+
+private:
+    std::array<std::uint64_t, NUM_BUCKETS> _buckets{};
+};
+
+#if __cplusplus < 201703L
+constexpr unsigned LatencyHistogram::SUB_BUCKET_BITS;
+constexpr std::size_t LatencyHistogram::SUB_BUCKETS;
+constexpr std::size_t LatencyHistogram::NUM_BUCKETS;
+#endif
+
+/**
+ * @brief What a TracingCallCheckContext (or ProfilingCallCheckContext) recorded for one call site.
+ */
+struct CallSiteStats {
+    /**
+     * The address of the called function, or a unique address standing for
+     * the tag (or the type of the callable) that identifies the call site.
+     */
+    const void *site;
+    /**
+     * The name of the tag, if the tag declares one (see TracingCallCheckContext).
+     */
+    const char *name;
+    LatencyHistogram latency;
+    std::uint64_t successes;
+    std::uint64_t failures;
+};
+
+/**
+ * @brief The statistics of all call sites at some point in time.
+ *
+ * Snapshots can be merged, e.g., to aggregate snapshots taken at different
+ * times or in different processes before exporting them.
+ */
+class TraceSnapshot {
+public:
+    using Sites = std::map<const void *, CallSiteStats>;
+
+    const Sites &sites() const noexcept { return _sites; }
+
+    const CallSiteStats *find(const void *site) const noexcept {
+        const auto it = _sites.find(site);
+        return it == _sites.end() ? nullptr : &it->second;
+    }
+
+    void merge(const CallSiteStats &stats) {
+        auto it = _sites.find(stats.site);
+        if (it == _sites.end()) {
+            _sites.emplace(stats.site, stats);
+            return;
+        }
+        it->second.latency.merge(stats.latency);
+        it->second.successes += stats.successes;
+        it->second.failures += stats.failures;
+        if (it->second.name == nullptr) {
+            it->second.name = stats.name;
+        }
+    }
+
+    void merge(const TraceSnapshot &other) {
+        for (const auto &site : other._sites) {
+            merge(site.second);
+        }
+    }
+
+private:
+    Sites _sites{};
+};
+
+namespace _auxiliary {
+
+/**
+ * Data that another header records per call site and thread in addition to the
+ * CallSiteCounters (e.g., perfcounters.hpp). A call site has at most one
+ * extension. When its thread exits, the extension is kept by the registry, or
+ * merged into the one it already keeps for the call site.
+ */
+class CallSiteExtension {
+public:
+    virtual ~CallSiteExtension() = default;
+
+    /**
+     * Add the data of the same call site in another thread. Called with the
+     * registry's mutex held.
+     */
+    virtual void merge(const CallSiteExtension &other) noexcept = 0;
+};
+
+/**
+ * The counters of one call site in one thread. Only the owning thread writes
+ * them, so a relaxed load and store suffice (no atomic read-modify-write).
+ * Other threads read them when taking a snapshot.
+ */
+class CallSiteCounters {
+public:
+    CallSiteCounters(const void *site, const char *name) noexcept : _site{site}, _name{name} {}
+
+    CallSiteCounters(const CallSiteCounters &) = delete;
+    CallSiteCounters &operator=(const CallSiteCounters &) = delete;
+
+    ~CallSiteCounters() { delete _extension.load(std::memory_order_relaxed); }
+
+    void record(std::uint64_t nanos, bool ok) noexcept {
+        _increment(_buckets[LatencyHistogram::bucketOf(nanos)]);
+        _increment(ok ? _successes : _failures);
+    }
+
+    /**
+     * The extension attached to this call site, or nullptr.
+     */
+    CallSiteExtension *extension() const noexcept {
+        return _extension.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Only the owning thread attaches an extension, and only once.
+     */
+    void attach(std::unique_ptr<CallSiteExtension> extension) noexcept {
+        _extension.store(extension.release(), std::memory_order_release);
+    }
+
+    std::unique_ptr<CallSiteExtension> detach() noexcept {
+        return std::unique_ptr<CallSiteExtension>{
+                _extension.exchange(nullptr, std::memory_order_relaxed)};
+    }
+
+    CallSiteStats stats() const noexcept {
+        CallSiteStats stats{_site, _name, {}, _successes.load(std::memory_order_relaxed),
+                            _failures.load(std::memory_order_relaxed)};
+        for (std::size_t i = 0; i < LatencyHistogram::NUM_BUCKETS; i++) {
+            const auto count = _buckets[i].load(std::memory_order_relaxed);
+            if (count > 0) {
+                stats.latency.record(LatencyHistogram::lowerBound(i), count);
+            }
+        }
+        return stats;
+    }
+
+private:
+    static void _increment(std::atomic<std::uint64_t> &counter) noexcept {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    const void *_site;
+    const char *_name;
+    std::array<std::atomic<std::uint64_t>, LatencyHistogram::NUM_BUCKETS> _buckets{};
+    std::atomic<std::uint64_t> _successes{0};
+    std::atomic<std::uint64_t> _failures{0};
+    std::atomic<CallSiteExtension *> _extension{nullptr};
+};
+
+class ThreadTrace;
+
+}  // namespace _auxiliary
+
+/**
+ * @brief Collects the statistics of all threads that use a TracingCallCheckContext.
+ */
+class TraceRegistry {
+public:
+    static TraceRegistry &instance() {
+        static TraceRegistry registry{};
+        return registry;
+    }
+
+    /**
+     * The statistics of all call sites, summed over all threads (including
+     * those that have exited).
+     */
+    TraceSnapshot snapshot() const;
+
+    /**
+     * Call visitor(site, extension) for the CallSiteExtension of every call
+     * site that has one, in all threads (including those that have exited).
+     * The registry's mutex is held meanwhile.
+     */
+    template <class Visitor>
+    void visitExtensions(Visitor &&visitor) const;
+
+private:
+    friend class _auxiliary::ThreadTrace;
+
+    TraceRegistry() = default;
+
+    // protects _threads, _exited, _exitedExtensions and the call sites of all threads
+    mutable std::mutex _mutex{};
+    std::vector<const _auxiliary::ThreadTrace *> _threads{};
+    TraceSnapshot _exited{};
+    std::map<const void *, std::unique_ptr<_auxiliary::CallSiteExtension>> _exitedExtensions{};
+};
+
+namespace _auxiliary {
+
+/**
+ * The counters of all call sites used by one thread.
+ */
+class ThreadTrace {
+public:
+    static ThreadTrace &local() {
+        thread_local ThreadTrace trace{};
+        return trace;
+    }
+
+    ThreadTrace(const ThreadTrace &) = delete;
+    ThreadTrace &operator=(const ThreadTrace &) = delete;
+
+    ~ThreadTrace() {
+        std::lock_guard<std::mutex> lock{_registry._mutex};
+        _snapshotInto(_registry._exited);
+        _keepExtensions(_registry._exitedExtensions);
+        auto &threads = _registry._threads;
+        threads.erase(std::find(threads.begin(), threads.end(), this));
+    }
+
+    CallSiteCounters &counters(const void *site, const char *name = nullptr) {
+        if (site == _lastSite) {
+            return *_lastCounters;
+        }
+        auto it = _sites.find(site);
+        if (it == _sites.end()) {
+            // only this thread modifies _sites, but snapshots read it
+            std::lock_guard<std::mutex> lock{_registry._mutex};
+            it = _sites.emplace(site, std::make_unique<CallSiteCounters>(site, name)).first;
+        }
+        _lastSite = site;
+        _lastCounters = it->second.get();
+        return *_lastCounters;
+    }
+
+private:
+    friend class ::cppc::TraceRegistry;
+
+    ThreadTrace() : _registry{TraceRegistry::instance()} {
+        std::lock_guard<std::mutex> lock{_registry._mutex};
+        _registry._threads.push_back(this);
+    }
+
+    /**
+     * Must be called with the registry's mutex held.
+     */
+    void _snapshotInto(TraceSnapshot &snapshot) const {
+        for (const auto &site : _sites) {
+            snapshot.merge(site.second->stats());
+        }
+    }
+
+    /**
+     * Must be called with the registry's mutex held.
+     */
+    void _keepExtensions(
+            std::map<const void *, std::unique_ptr<CallSiteExtension>> &extensions) const {
+        for (const auto &site : _sites) {
+            const auto *extension = site.second->extension();
+            if (extension == nullptr) {
+                continue;
+            }
+            const auto it = extensions.find(site.first);
+            if (it == extensions.end()) {
+                extensions.emplace(site.first, site.second->detach());
+            } else {
+                it->second->merge(*extension);
+            }
+        }
+    }
+
+    TraceRegistry &_registry;
+    std::unordered_map<const void *, std::unique_ptr<CallSiteCounters>> _sites{};
+    const void *_lastSite{nullptr};
+    CallSiteCounters *_lastCounters{nullptr};
+};
+
+/**
+ * A unique address for every type, used as the call site of tags and of
+ * callables that are not function pointers.
+ */
+template <class T>
+struct TypeKey {
+    static constexpr char key{0};
+};
+
+#if __cplusplus < 201703L
+template <class T>
+constexpr char TypeKey<T>::key;
+#endif
+
+template <class Tag, class = VoidT<>>
+struct TagName {
+    static constexpr const char *value() noexcept { return nullptr; }
+};
+
+template <class Tag>
+struct TagName<Tag, VoidT<decltype(Tag::name)>> {
+    static constexpr const char *value() noexcept { return Tag::name; }
+};
+
+/**
+ * The counters of a call site that is known at compile time. The lookup is
+ * done once per thread.
+ */
+template <class Key>
+inline CallSiteCounters &staticCallSiteCounters() {
+    thread_local CallSiteCounters &counters{
+            ThreadTrace::local().counters(&TypeKey<Key>::key, TagName<Key>::value())};
+    return counters;
+}
+
+template <class Tag>
+struct CallSiteOf {
+    template <class Callable>
+    static CallSiteCounters &counters(const Callable &) {
+        return staticCallSiteCounters<Tag>();
+    }
+};
+
+/**
+ * Without a tag, function pointers are identified by their address, other
+ * callables by their type.
+ */
+template <>
+struct CallSiteOf<void> {
+    template <class Callable>
+    using IsFunction = std::is_function<std::remove_pointer_t<std::decay_t<Callable>>>;
+
+    template <class Callable, std::enable_if_t<IsFunction<Callable>::value, int> = 0>
+    static CallSiteCounters &counters(const Callable &callable) {
+        const std::decay_t<Callable> function{callable};
+        return ThreadTrace::local().counters(reinterpret_cast<const void *>(function));
+    }
+
+    template <class Callable, std::enable_if_t<!IsFunction<Callable>::value, int> = 0>
+    static CallSiteCounters &counters(const Callable &) {
+        return staticCallSiteCounters<Callable>();
+    }
+};
+
+}  // namespace _auxiliary
+
+inline TraceSnapshot TraceRegistry::snapshot() const {
+    std::lock_guard<std::mutex> lock{_mutex};
+    TraceSnapshot snapshot{_exited};
+    for (const auto *thread : _threads) {
+        thread->_snapshotInto(snapshot);
+    }
+    return snapshot;
+}
+
+template <class Visitor>
+inline void TraceRegistry::visitExtensions(Visitor &&visitor) const {
+    std::lock_guard<std::mutex> lock{_mutex};
+    for (const auto &site : _exitedExtensions) {
+        visitor(site.first, static_cast<const _auxiliary::CallSiteExtension &>(*site.second));
+    }
+    for (const auto *thread : _threads) {
+        for (const auto &site : thread->_sites) {
+            const auto *extension = site.second->extension();
+            if (extension != nullptr) {
+                visitor(site.first, *extension);
+            }
+        }
+    }
+}
+
+/**
+ * @brief A CallCheckContext that records latency and outcome of every call.
+ *
+ * This is a drop-in replacement for CallCheckContext. Every call is timed and
+ * recorded, along with whether the ReturnCheckPolicy accepted the return
+ * value, into a histogram of the calling thread. Recording neither locks nor
+ * uses atomic read-modify-write operations. TraceRegistry::snapshot() sums the
+ * histograms of all threads.
+ *
+ * Calls are grouped by call site. A call site is the Tag, if given: a type
+ * that may declare a `static constexpr const char *name`. Otherwise, it is the
+ * called function (if the callable is a function pointer) or the type of the
+ * callable (for lambdas and other function objects):
+ *
+ *  struct ReadTag {
+ *      static constexpr const char *name{"read"};
+ *  };
+ *  using ct = TracingCallCheckContext<IsNotNegativeReturnCheckPolicy, ErrnoErrorPolicy, ReadTag>;
+ *
+ * If CPPC_NO_TRACING is defined, nothing is recorded and the context compiles
+ * to exactly the same code as CallCheckContext.
+ */
+template <class ReturnCheckPolicy = DefaultReturnCheckPolicy,
+          class ErrorPolicy = DefaultErrorPolicy,
+          class Tag = void>
+class TracingCallCheckContext {
+public:
+    template <class Callable, class... Args>
+    static inline auto callChecked(Callable &&callable, Args &&... args) {
+#ifdef CPPC_NO_TRACING
+        return ::cppc::callChecked<ReturnCheckPolicy, ErrorPolicy>(
+                std::forward<Callable>(callable), std::forward<Args>(args)...);
+#else
+        using Clock = std::chrono::steady_clock;
+        using Rv = std::decay_t<decltype(callable(std::forward<Args>(args)...))>;
+        auto &counters = _auxiliary::CallSiteOf<Tag>::counters(callable);
+        auto call = [&counters](Callable &c, Args &&... a) -> Rv {
+            const auto start = Clock::now();
+            // looking up the call site may set errno, so reset it only now
+            _auxiliary::callPrecCallIfPresent<ReturnCheckPolicy>();
+            Rv rv = c(std::forward<Args>(a)...);
+            const auto nanos =
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start);
+            counters.record(static_cast<std::uint64_t>(nanos.count()),
+                            ReturnCheckPolicy::returnValueIsOk(rv));
+            return rv;
+        };
+        return _auxiliary::ReturnCheckWrapper<ReturnCheckPolicy, ErrorPolicy, Rv>::
+                callAndHandleReturnValue(call, callable, std::forward<Args>(args)...);
+#endif
+    }
+};
+
+}  // namespace cppc
@@ -0,0 +1,449 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "checkcall.hpp"
+#include "guard.hpp"
+
+namespace cppc {
+
+class IoUring;
+
+/**
+ * @brief A FreePolicy that closes a file descriptor through an IoUring.
+ *
+ * The close is queued and submitted together with the next batch of
+ * operations (see IoUring::close), so closing many descriptors does not cost
+ * one syscall each.
+ */
+struct UringCloser {
+    IoUring *ring;
+
+    inline void operator()(int fd) const noexcept;
+
+    static constexpr int nullValue() noexcept { return -1; }
+};
+
+using UringFdGuard = Guard<int, UringCloser>;
+
+/**
+ * Identifies an operation submitted to an IoUring. Its result is obtained
+ * with IoUring::result, which must be called exactly once per ticket.
+ */
+struct IoTicket {
+    std::uint32_t slot;
+};
+
+/**
+ * @brief Issues read, write, openat and close as batched io_uring operations.
+ *
+ * Operations are queued in the submission ring and handed to the kernel with
+ * a single io_uring_enter when a result is needed, when the ring is full, or
+ * when submit() is called. Results are checked like return values of the
+ * corresponding syscalls, except that io_uring reports errors as negative
+ * errno values. Hence, they go through ErrorCodeErrorPolicy by default:
+ *
+ *  IoUring ring{};
+ *  UringFdGuard fd{ring.open(AT_FDCWD, "data", O_RDONLY)};
+ *  const auto first = ring.read(fd.get(), buf, sizeof(buf), 0);
+ *  const auto second = ring.read(fd.get(), buf + sizeof(buf), sizeof(buf), sizeof(buf));
+ *  ring.result(first);  // submits both reads at once
+ *  ring.result(second);
+ *
+ * If io_uring is not available (old kernel, disabled by sysctl or seccomp),
+ * or IoBackend::SYSCALLS is requested, every operation is carried out right
+ * away with the plain syscall and its result is reported the same way.
+ *
+ * The ring is not thread-safe. The destructor waits for all submitted
+ * operations, including queued closes.
+ */
+class IoUring {
+public:
+    enum class IoBackend { AUTO, SYSCALLS };
+
+    explicit IoUring(unsigned entries = 64, IoBackend backend = IoBackend::AUTO);
+
+    IoUring(const IoUring &) = delete;
+    IoUring &operator=(const IoUring &) = delete;
+
+    ~IoUring();
+
+    bool usesSyscalls() const noexcept { return _ringFd < 0; }
+
+    /**
+     * Queue a read. An offset of -1 reads from the current file position.
+     */
+    IoTicket read(int fd, void *buf, unsigned count, std::int64_t offset = -1);
+
+    IoTicket write(int fd, const void *buf, unsigned count, std::int64_t offset = -1);
+
+    /**
+     * Queue an openat. The path is not copied: the kernel reads it when the
+     * operation is handed over, so it must stay valid until submit() or
+     * result() (for any ticket) has been called, or until the ring has
+     * submitted its queued operations because it was full.
+     */
+    IoTicket openat(int dirfd, const char *path, int flags, mode_t mode = 0);
+
+    /**
+     * Queue a close. Its result is ignored, as there is nothing the caller
+     * could do about a failed close.
+     */
+    void close(int fd) noexcept;
+
+    /**
+     * Hand all queued operations to the kernel. Returns their number.
+     */
+    unsigned submit();
+
+    /**
+     * Wait for the operation to complete and check its result. Returns the
+     * result of the corresponding syscall (e.g., the number of bytes read),
+     * or whatever ErrorPolicy returns for a failed operation.
+     */
+    template <class ErrorPolicy = ErrorCodeErrorPolicy>
+    auto result(IoTicket ticket) {
+        const int res{_wait(ticket)};
+        return callChecked<IsNotNegativeReturnCheckPolicy, ErrorPolicy>([res]() { return res; });
+    }
+
+    /**
+     * Open a file and guard the descriptor. The descriptor is closed through
+     * this ring, which therefore has to outlive the Guard.
+     */
+    template <class ErrorPolicy = ErrorCodeErrorPolicy>
+    UringFdGuard open(int dirfd, const char *path, int flags, mode_t mode = 0) {
+        return guard(result<ErrorPolicy>(openat(dirfd, path, flags, mode)));
+    }
+
+    UringFdGuard guard(int fd) noexcept { return UringFdGuard{UringCloser{this}, fd}; }
+
+private:
+    static constexpr std::uint64_t _IGNORE_RESULT{~std::uint64_t{0}};
+
+    struct _Slot {
+        int result;
+        bool done;
+    };
+
+    static int _syscallResult(long rv) noexcept { return rv < 0 ? -errno : static_cast<int>(rv); }
+
+    bool _setup(unsigned entries);
+    void _teardown() noexcept;
+    IoTicket _newTicket();
+    IoTicket _completed(int result);
+    io_uring_sqe *_nextSqe();
+    int _enter(unsigned toSubmit, unsigned minComplete, bool getEvents);
+    void _reap() noexcept;
+    int _wait(IoTicket ticket);
+
+    int _ringFd{-1};
+    void *_ringMemory{nullptr};
+    std::size_t _ringSize{0};
+    io_uring_sqe *_sqes{nullptr};
+    std::size_t _sqesSize{0};
+
+    unsigned *_sqHead{nullptr};
+    unsigned *_sqTail{nullptr};
+    unsigned *_sqArray{nullptr};
+    unsigned _sqMask{0};
+    unsigned _sqEntries{0};
+    unsigned *_cqHead{nullptr};
+    unsigned *_cqTail{nullptr};
+    io_uring_cqe *_cqes{nullptr};
+    unsigned _cqMask{0};
+
+    // operations queued, but not yet submitted, and submitted, but not yet completed
+    unsigned _queued{0};
+    std::size_t _inFlight{0};
+
+    std::vector<_Slot> _slots{};
+    std::vector<std::uint32_t> _freeSlots{};
+};
+
+namespace _auxiliary {
+
+inline int ioUringSetup(unsigned entries, io_uring_params *params) noexcept {
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+inline int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) noexcept {
+    return static_cast<int>(
+            ::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+}
+
+inline int ioUringRegister(int fd, unsigned opcode, void *arg, unsigned numArgs) noexcept {
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, numArgs));
+}
+
+/**
+ * Whether the kernel supports all operations used by IoUring.
+ */
+inline bool ioUringSupportsOps(int fd) noexcept {
+    constexpr unsigned numOps{256};
+    constexpr std::size_t size{sizeof(io_uring_probe) + numOps * sizeof(io_uring_probe_op)};
+    alignas(io_uring_probe) char buffer[size];
+    std::memset(buffer, 0, sizeof(buffer));
+    io_uring_probe *probe{reinterpret_cast<io_uring_probe *>(buffer)};
+    if (ioUringRegister(fd, IORING_REGISTER_PROBE, probe, numOps) < 0) {
+        return false;
+    }
+    for (const unsigned op : {IORING_OP_READ, IORING_OP_WRITE, IORING_OP_OPENAT, IORING_OP_CLOSE}) {
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace _auxiliary
+
+inline void UringCloser::operator()(int fd) const noexcept { ring->close(fd); }
+
+inline IoUring::IoUring(unsigned entries, IoBackend backend) {
+    if (backend == IoBackend::AUTO && !_setup(entries)) {
+        _teardown();
+    }
+}
+
+inline IoUring::~IoUring() {
+    if (!usesSyscalls()) {
+        try {
+            while (_queued > 0 || _inFlight > 0) {
+                _enter(_queued, _inFlight > 0 ? 1 : 0, _inFlight > 0);
+            }
+        } catch (const ErrnoError &) {
+            // nothing left to do but unmap the rings
+        }
+    }
+    _teardown();
+}
+
+inline bool IoUring::_setup(unsigned entries) {
+    io_uring_params params{};
+    _ringFd = _auxiliary::ioUringSetup(entries, &params);
+    if (_ringFd < 0) {
+        return false;
+    }
+    constexpr unsigned requiredFeatures{IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP |
+                                        IORING_FEAT_RW_CUR_POS};
+    if ((params.features & requiredFeatures) != requiredFeatures ||
+        !_auxiliary::ioUringSupportsOps(_ringFd)) {
+        return false;
+    }
+
+    // with IORING_FEAT_SINGLE_MMAP, both rings share one mapping
+    const std::size_t sqSize{params.sq_off.array + params.sq_entries * sizeof(unsigned)};
+    const std::size_t cqSize{params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe)};
+    _ringSize = sqSize > cqSize ? sqSize : cqSize;
+    void *ring{::mmap(nullptr, _ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      _ringFd, IORING_OFF_SQ_RING)};
+    if (ring == MAP_FAILED) {
+        return false;
+    }
+    _ringMemory = ring;
+    _sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqes{::mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      _ringFd, IORING_OFF_SQES)};
+    if (sqes == MAP_FAILED) {
+        return false;
+    }
+    _sqes = static_cast<io_uring_sqe *>(sqes);
+
+    char *base{static_cast<char *>(ring)};
+    _sqHead = reinterpret_cast<unsigned *>(base + params.sq_off.head);
+    _sqTail = reinterpret_cast<unsigned *>(base + params.sq_off.tail);
+    _sqArray = reinterpret_cast<unsigned *>(base + params.sq_off.array);
+    _sqMask = *reinterpret_cast<unsigned *>(base + params.sq_off.ring_mask);
+    _sqEntries = params.sq_entries;
+    _cqHead = reinterpret_cast<unsigned *>(base + params.cq_off.head);
+    _cqTail = reinterpret_cast<unsigned *>(base + params.cq_off.tail);
+    _cqes = reinterpret_cast<io_uring_cqe *>(base + params.cq_off.cqes);
+    _cqMask = *reinterpret_cast<unsigned *>(base + params.cq_off.ring_mask);
+    return true;
+}
+
+inline void IoUring::_teardown() noexcept {
+    if (_sqes != nullptr) {
+        ::munmap(_sqes, _sqesSize);
+        _sqes = nullptr;
+    }
+    if (_ringMemory != nullptr) {
+        ::munmap(_ringMemory, _ringSize);
+        _ringMemory = nullptr;
+    }
+    if (_ringFd >= 0) {
+        ::close(_ringFd);
+        _ringFd = -1;
+    }
+}
+
+inline IoTicket IoUring::_newTicket() {
+    if (_freeSlots.empty()) {
+        _slots.push_back(_Slot{0, false});
+        return IoTicket{static_cast<std::uint32_t>(_slots.size() - 1)};
+    }
+    const IoTicket ticket{_freeSlots.back()};
+    _freeSlots.pop_back();
+    _slots[ticket.slot] = _Slot{0, false};
+    return ticket;
+}
+
+inline IoTicket IoUring::_completed(int result) {
+    const IoTicket ticket{_newTicket()};
+    _slots[ticket.slot] = _Slot{result, true};
+    return ticket;
+}
+
+inline io_uring_sqe *IoUring::_nextSqe() {
+    const unsigned tail{*_sqTail + _queued};
+    if (tail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE) == _sqEntries) {
+        submit();
+        return _nextSqe();
+    }
+    io_uring_sqe *sqe{&_sqes[tail & _sqMask]};
+    std::memset(sqe, 0, sizeof(*sqe));
+    _sqArray[tail & _sqMask] = tail & _sqMask;
+    _queued++;
+    return sqe;
+}
+
+inline IoTicket IoUring::read(int fd, void *buf, unsigned count, std::int64_t offset) {
+    if (usesSyscalls()) {
+        return _completed(_syscallResult(offset < 0 ? ::read(fd, buf, count)
+                                                    : ::pread(fd, buf, count, offset)));
+    }
+    const IoTicket ticket{_newTicket()};
+    io_uring_sqe *sqe{_nextSqe()};
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<std::uintptr_t>(buf);
+    sqe->len = count;
+    sqe->off = static_cast<std::uint64_t>(offset);
+    sqe->user_data = ticket.slot;
+    return ticket;
+}
+
+inline IoTicket IoUring::write(int fd, const void *buf, unsigned count, std::int64_t offset) {
+    if (usesSyscalls()) {
+        return _completed(_syscallResult(offset < 0 ? ::write(fd, buf, count)
+                                                    : ::pwrite(fd, buf, count, offset)));
+    }
+    const IoTicket ticket{_newTicket()};
+    io_uring_sqe *sqe{_nextSqe()};
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<std::uintptr_t>(buf);
+    sqe->len = count;
+    sqe->off = static_cast<std::uint64_t>(offset);
+    sqe->user_data = ticket.slot;
+    return ticket;
+}
+
+inline IoTicket IoUring::openat(int dirfd, const char *path, int flags, mode_t mode) {
+    if (usesSyscalls()) {
+        return _completed(_syscallResult(::openat(dirfd, path, flags, mode)));
+    }
+    const IoTicket ticket{_newTicket()};
+    io_uring_sqe *sqe{_nextSqe()};
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = dirfd;
+    sqe->addr = reinterpret_cast<std::uintptr_t>(path);
+    sqe->len = mode;
+    sqe->open_flags = static_cast<std::uint32_t>(flags);
+    sqe->user_data = ticket.slot;
+    return ticket;
+}
+
+inline void IoUring::close(int fd) noexcept {
+    if (!usesSyscalls()) {
+        try {
+            io_uring_sqe *sqe{_nextSqe()};
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd = fd;
+            sqe->user_data = _IGNORE_RESULT;
+            return;
+        } catch (const ErrnoError &) {
+            // the ring is unusable, close right away
+        }
+    }
+    ::close(fd);
+}
+
+inline unsigned IoUring::submit() {
+    if (usesSyscalls() || _queued == 0) {
+        return 0;
+    }
+    const unsigned submitted{_queued};
+    _enter(_queued, 0, false);
+    return submitted;
+}
+
+inline int IoUring::_enter(unsigned toSubmit, unsigned minComplete, bool getEvents) {
+    __atomic_store_n(_sqTail, *_sqTail + toSubmit, __ATOMIC_RELEASE);
+    _queued -= toSubmit;
+    _inFlight += toSubmit;
+    while (true) {
+        const int rv{_auxiliary::ioUringEnter(_ringFd, toSubmit, minComplete,
+                                              getEvents ? IORING_ENTER_GETEVENTS : 0)};
+        _reap();
+        if (rv >= 0 && static_cast<unsigned>(rv) >= toSubmit) {
+            return rv;
+        }
+        if (rv >= 0) {
+            toSubmit -= static_cast<unsigned>(rv);
+        } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            ErrnoErrorPolicy::handleError(rv);
+        }
+    }
+}
+
+inline void IoUring::_reap() noexcept {
+    unsigned head{*_cqHead};
+    const unsigned tail{__atomic_load_n(_cqTail, __ATOMIC_ACQUIRE)};
+    for (; head != tail; head++) {
+        const io_uring_cqe &cqe{_cqes[head & _cqMask]};
+        if (cqe.user_data != _IGNORE_RESULT) {
+            _slots[cqe.user_data] = _Slot{cqe.res, true};
+        }
+        _inFlight--;
+    }
+    __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+}
+
+inline int IoUring::_wait(IoTicket ticket) {
+    while (!_slots[ticket.slot].done) {
+        _enter(_queued, 1, true);
+    }
+    _freeSlots.push_back(ticket.slot);
+    return _slots[ticket.slot].result;
+}
+
+}  // namespace cppc
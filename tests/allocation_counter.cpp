@@ -0,0 +1,111 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#include "allocation_counter.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+/*
+ * Count every allocation made by the current thread. The counter has no
+ * dynamic initialization, so it can be used before the C++ runtime has been
+ * initialized.
+ */
+static thread_local std::size_t allocationCount{0};
+
+std::size_t cppc::testing::AllocationCounter::allocationsSoFar() noexcept {
+    return allocationCount;
+}
+
+#if defined(__GLIBC__)
+
+/*
+ * With glibc, malloc and friends are replaced by functions that count and
+ * then call glibc's implementation. This covers operator new (which calls
+ * malloc) as well as allocations made by C code.
+ */
+extern "C" {
+
+void *__libc_malloc(std::size_t);
+void *__libc_calloc(std::size_t, std::size_t);
+void *__libc_realloc(void *, std::size_t);
+void *__libc_memalign(std::size_t, std::size_t);
+
+void *malloc(std::size_t size) {
+    allocationCount++;
+    return __libc_malloc(size);
+}
+
+void *calloc(std::size_t num, std::size_t size) {
+    allocationCount++;
+    return __libc_calloc(num, size);
+}
+
+void *realloc(void *ptr, std::size_t size) {
+    allocationCount++;
+    return __libc_realloc(ptr, size);
+}
+
+void *aligned_alloc(std::size_t alignment, std::size_t size) {
+    allocationCount++;
+    return __libc_memalign(alignment, size);
+}
+
+void *memalign(std::size_t alignment, std::size_t size) {
+    allocationCount++;
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, std::size_t alignment, std::size_t size) {
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    allocationCount++;
+    void *memory{__libc_memalign(alignment, size)};
+    if (memory == nullptr) {
+        return ENOMEM;
+    }
+    *ptr = memory;
+    return 0;
+}
+}
+
+#else
+
+/*
+ * Elsewhere, only allocations by operator new are counted.
+ */
+void *operator new(std::size_t size) {
+    allocationCount++;
+    if (void *memory = std::malloc(size == 0 ? 1 : size)) {
+        return memory;
+    }
+    throw std::bad_alloc{};
+}
+
+void *operator new[](std::size_t size) { return ::operator new(size); }
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+void operator delete[](void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+#endif
@@ -0,0 +1,64 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+
+#include "gtest/gtest.h"
+
+namespace cppc {
+
+namespace testing {
+
+/**
+ * @brief Counts the heap allocations of the current thread while it exists.
+ *
+ * The test binary replaces malloc and friends (see allocation_counter.cpp),
+ * so this includes allocations by operator new, the C++ runtime and C
+ * libraries. Counters can be nested.
+ */
+class AllocationCounter {
+public:
+    AllocationCounter() noexcept : _start{allocationsSoFar()} {}
+
+    std::size_t allocations() const noexcept { return allocationsSoFar() - _start; }
+
+    /**
+     * The number of allocations made by the current thread since it started.
+     */
+    static std::size_t allocationsSoFar() noexcept;
+
+private:
+    std::size_t _start;
+};
+
+}  // namespace testing
+
+}  // namespace cppc
+
+/**
+ * Assert that the given statements (including the destruction of anything
+ * they declare) do not allocate heap memory.
+ */
+#define ASSERT_NO_ALLOCATION(...)                                                  \
+    do {                                                                           \
+        ::cppc::testing::AllocationCounter _allocationCounter{};                   \
+        {                                                                          \
+            __VA_ARGS__;                                                           \
+        }                                                                          \
+        ASSERT_EQ(_allocationCounter.allocations(), 0u) << "in: " << #__VA_ARGS__; \
+    } while (false)
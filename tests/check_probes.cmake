@@ -0,0 +1,45 @@
+#   Copyright 2016-2019 Marcus Gelderie
+#
+#   Licensed under the Apache License, Version 2.0 (the "License");
+#   you may not use this file except in compliance with the License.
+#   You may obtain a copy of the License at
+#
+#       http://www.apache.org/licenses/LICENSE-2.0
+#
+#   Unless required by applicable law or agreed to in writing, software
+#   distributed under the License is distributed on an "AS IS" BASIS,
+#   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#   See the License for the specific language governing permissions and
+#   limitations under the License.
+
+# Checks that a binary contains the notes of the given USDT probes of the
+# provider 'cppc' (see probes.hpp).
+#
+# usage: cmake -DREADELF=<readelf> -DBINARY=<binary> -DPROBES=<probe>,... -P check_probes.cmake
+
+foreach (_var READELF BINARY PROBES)
+    if (NOT DEFINED ${_var})
+        message(FATAL_ERROR "${_var} not set")
+    endif (NOT DEFINED ${_var})
+endforeach (_var)
+
+execute_process(COMMAND ${READELF} --notes ${BINARY}
+                OUTPUT_VARIABLE _notes
+                RESULT_VARIABLE _result)
+if (NOT _result EQUAL 0)
+    message(FATAL_ERROR "${READELF} failed on ${BINARY}")
+endif (NOT _result EQUAL 0)
+
+string(REPLACE "," ";" PROBES "${PROBES}")
+set(_missing "")
+foreach (_probe ${PROBES})
+    if (NOT _notes MATCHES "Provider: cppc[\r\n\t ]+Name: ${_probe}[\r\n]")
+        list(APPEND _missing ${_probe})
+    endif (NOT _notes MATCHES "Provider: cppc[\r\n\t ]+Name: ${_probe}[\r\n]")
+endforeach (_probe)
+
+if (_missing)
+    message(FATAL_ERROR "${BINARY} lacks the probes: ${_missing}")
+endif (_missing)
+list(LENGTH PROBES _count)
+message(STATUS "Found ${_count} probe(s) in ${BINARY}")
@@ -0,0 +1,49 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+/*
+ * This file is not linked into any test. It is compiled to assembly and the
+ * functions prefixed with 'cppc_codegen_expected_' are compared to their
+ * counterparts prefixed with 'cppc_codegen_actual_' (see compare_codegen.cmake).
+ */
+
+#include "checkcall.hpp"
+
+extern "C" {
+
+int codegen_call(int, const char *);
+
+[[noreturn]] void codegen_fail(int);
+
+struct CodegenErrorPolicy {
+    static void handleError(int rv) { codegen_fail(rv); }
+};
+
+constexpr cppc::CheckedFunction<decltype(&codegen_call), &codegen_call,
+                                cppc::IsNotNegativeReturnCheckPolicy, CodegenErrorPolicy>
+        checkedCodegenCall{};
+
+int cppc_codegen_expected_checked_call(int arg, const char *str) {
+    const int rv{codegen_call(arg, str)};
+    if (rv < 0) {
+        codegen_fail(rv);
+    }
+    return rv;
+}
+
+int cppc_codegen_actual_checked_call(int arg, const char *str) {
+    return checkedCodegenCall(arg, str);
+}
+}
@@ -15,12 +15,22 @@
  */
 
 #include <cerrno>
+#include <cstdio>
 #include <cstring>
 #include <iostream>
+#include <memory>
 #include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 #include "gtest/gtest.h"
 
+#include "batch.hpp"
+#include "allocation_counter.h"
 #include "checkcall.hpp"
 #include "test_api.h"
 
@@ -140,6 +150,168 @@ TEST_F(CheckCallTest, testModifyReturnValue) {
                   "The return type must be same as ErrorPolicies return-value-type");
 }
 
+struct AcceptAnyReturnCheckPolicy {
+    template <class Rv>
+    static bool returnValueIsOk(const Rv &) {
+        return true;
+    }
+};
+
+struct RejectAnyReturnCheckPolicy {
+    template <class Rv>
+    static bool returnValueIsOk(const Rv &) {
+        return false;
+    }
+};
+
+/**
+ * An ErrorPolicy that passes the return value through. The value is moved
+ * into the policy, so the policy can move it on.
+ */
+struct PassThroughErrorPolicy {
+    static some_type_t handleError(some_type_t &&value) { return std::move(value); }
+    static some_type_t handleOk(some_type_t &&value) { return std::move(value); }
+};
+
+TEST_F(CheckCallTest, testReturnValueIsNotCopied) {
+    some_type_t::reset();
+    const auto value = callChecked<AcceptAnyReturnCheckPolicy>([]() { return some_type_t{}; });
+    ASSERT_EQ(some_type_t::getNumberOfConstructorCalls(), 1u);
+    static_assert(std::is_same<decltype(value), const some_type_t>::value,
+                  "Should return the return type of the callable");
+}
+
+TEST_F(CheckCallTest, testModifiedReturnValueIsNotCopied) {
+    some_type_t::reset();
+    callChecked<AcceptAnyReturnCheckPolicy, PassThroughErrorPolicy>(
+            []() { return some_type_t{}; });
+    ASSERT_EQ(some_type_t::getNumberOfConstructorCalls(), 1u);
+    callChecked<RejectAnyReturnCheckPolicy, PassThroughErrorPolicy>(
+            []() { return some_type_t{}; });
+    ASSERT_EQ(some_type_t::getNumberOfConstructorCalls(), 2u);
+}
+
+TEST_F(CheckCallTest, testMoveOnlyReturnValue) {
+    auto value = callChecked<IsNotNullptrReturnCheckPolicy>([]() {
+        return std::make_unique<int>(17);
+    });
+    static_assert(std::is_same<decltype(value), std::unique_ptr<int>>::value,
+                  "Should return the return type of the callable");
+    ASSERT_EQ(*value, 17);
+    ASSERT_THROW(callChecked<IsNotNullptrReturnCheckPolicy>(
+                         []() { return std::unique_ptr<int>{}; }),
+                 ReturnValueError);
+}
+
+/**
+ * Tests for callCheckedBatch.
+ */
+struct RecordBatchErrorPolicy {
+    static BatchResult<int> lastResult;
+    static unsigned int numCalls;
+
+    static void handleError(const BatchResult<int> &result) {
+        lastResult = result;
+        numCalls++;
+    }
+};
+
+BatchResult<int> RecordBatchErrorPolicy::lastResult{};
+unsigned int RecordBatchErrorPolicy::numCalls{0};
+
+class CheckCallBatchTest : public ::testing::Test {
+public:
+    void SetUp() override {
+        MockAPI::instance().reset();
+        RecordBatchErrorPolicy::lastResult = BatchResult<int>{};
+        RecordBatchErrorPolicy::numCalls = 0;
+    }
+};
+
+TEST_F(CheckCallBatchTest, testAllCallsSucceed) {
+    const std::vector<std::tuple<int>> arguments{std::make_tuple(0), std::make_tuple(0)};
+    const auto result = callCheckedBatch<IsZeroReturnCheckPolicy, RecordBatchErrorPolicy>(
+            some_func_with_error_code, arguments);
+    ASSERT_TRUE(result.ok());
+    ASSERT_EQ(result.size(), 2u);
+    ASSERT_NUM_CALLED(MockAPI::instance().someFuncWithErrorCode(), 2);
+    ASSERT_EQ(RecordBatchErrorPolicy::numCalls, 0u);
+}
+
+TEST_F(CheckCallBatchTest, testFailuresAreReportedOnce) {
+    std::vector<std::tuple<int, int *>> arguments{};
+    int called{0};
+    for (int i = 0; i < 100; i++) {
+        arguments.emplace_back(i % 10 == 3 ? 0 : i + 1, &called);
+    }
+    callCheckedBatch<IsNotZeroReturnCheckPolicy, RecordBatchErrorPolicy>(
+            c_api_some_func_with_error_code, arguments);
+    ASSERT_EQ(called, 100);
+    ASSERT_EQ(RecordBatchErrorPolicy::numCalls, 1u);
+    const auto &failures = RecordBatchErrorPolicy::lastResult.failures();
+    ASSERT_EQ(failures.size(), 10u);
+    for (std::size_t i = 0; i < failures.size(); i++) {
+        ASSERT_EQ(failures[i].index, i * 10 + 3);
+        ASSERT_EQ(failures[i].returnValue, 0);
+    }
+}
+
+TEST_F(CheckCallBatchTest, testDefaultErrorPolicyThrowsOnce) {
+    const std::vector<std::tuple<int>> arguments{std::make_tuple(-1), std::make_tuple(-2)};
+    ASSERT_THROW(callCheckedBatch(some_func_with_error_code, arguments), ReturnValueError);
+    ASSERT_NUM_CALLED(MockAPI::instance().someFuncWithErrorCode(), 2);
+}
+
+TEST_F(CheckCallBatchTest, testPreCallBeforeEveryCall) {
+    const std::vector<std::pair<int, int>> arguments{{0, 0}, {EINVAL, 0}, {0, 0}};
+    auto setErrno = [](int error, int rv) {
+        if (errno != 0) {
+            return -1;  // preCall did not reset errno
+        }
+        errno = error;
+        return rv;
+    };
+    callCheckedBatch<IsErrnoZeroReturnCheckPolicy, RecordBatchErrorPolicy>(setErrno, arguments);
+    ASSERT_EQ(RecordBatchErrorPolicy::numCalls, 1u);
+    const auto &failures = RecordBatchErrorPolicy::lastResult.failures();
+    ASSERT_EQ(failures.size(), 1u);
+    ASSERT_EQ(failures[0].index, 1u);
+    ASSERT_EQ(failures[0].returnValue, 0);
+}
+
+TEST_F(CheckCallBatchTest, testErrnoOfFailedCalls) {
+    const std::vector<std::pair<int, int>> arguments{{0, 0}, {EINVAL, -1}, {EBADF, -1}};
+    auto setErrno = [](int error, int rv) {
+        errno = error;
+        return rv;
+    };
+    callCheckedBatch<IsNotNegativeReturnCheckPolicy, RecordBatchErrorPolicy>(setErrno, arguments);
+    const auto &failures = RecordBatchErrorPolicy::lastResult.failures();
+    ASSERT_EQ(failures.size(), 2u);
+    ASSERT_EQ(failures[0].error, EINVAL);
+    ASSERT_EQ(failures[1].error, EBADF);
+
+    try {
+        callCheckedBatch<IsNotNegativeReturnCheckPolicy, ErrnoErrorPolicy>(setErrno, arguments);
+        FAIL() << "Execution should not reach this line";
+    } catch (const ErrnoError &e) {
+        ASSERT_EQ(e.code(), std::errc::invalid_argument);
+    }
+}
+
+TEST_F(CheckCallBatchTest, testErrorCodeOfFirstFailedCall) {
+    const std::vector<std::tuple<int>> arguments{
+            std::make_tuple(0), std::make_tuple(-EAGAIN), std::make_tuple(-EBADF)};
+    try {
+        callCheckedBatch<IsZeroReturnCheckPolicy, ErrorCodeErrorPolicy>(some_func_with_error_code,
+                                                                        arguments);
+        FAIL() << "Execution should not reach this line";
+    } catch (const ErrnoError &e) {
+        ASSERT_EQ(e.code(), std::errc::resource_unavailable_try_again);
+    }
+    ASSERT_NUM_CALLED(MockAPI::instance().someFuncWithErrorCode(), 3);
+}
+
 /**
  * Tests for the CallGuard class.
  */
@@ -281,3 +453,226 @@ TEST_F(CallGuardTest, testReportReturnValueErrorPolicy) {
     }
     FAIL() << "Execution should not reach this line";
 }
+
+/**
+ * Tests for the CheckedFunction class.
+ */
+using CheckedSomeFunc = CheckedFunction<decltype(&some_func_with_error_code),
+                                        &some_func_with_error_code,
+                                        IsNotNegativeReturnCheckPolicy>;
+
+TEST_F(CheckCallTest, testCheckedFunction) {
+    constexpr CheckedSomeFunc checked{};
+    const auto x = checked(17);
+    ASSERT_CALLED(MockAPI::instance().someFuncWithErrorCode());
+    ASSERT_EQ(x, 17);
+    ASSERT_THROW(checked(-1), std::runtime_error);
+}
+
+TEST_F(CheckCallTest, testCheckedFunctionCFunctionCall) {
+    constexpr CheckedFunction<decltype(&c_api_some_func_with_error_code),
+                              &c_api_some_func_with_error_code, IsNotZeroReturnCheckPolicy>
+            checked{};
+    int called = 0;
+    ASSERT_EQ(checked(17, &called), 17);
+    ASSERT_EQ(called, 1);
+}
+
+TEST_F(CheckCallTest, testCheckedFunctionModifyReturnValue) {
+    constexpr CheckedFunction<decltype(&some_func_with_error_code), &some_func_with_error_code,
+                              IsZeroReturnCheckPolicy,
+                              CustomErrorPolicyWithReturnValueModification>
+            checked{};
+    ASSERT_EQ(checked(-1), "false");
+    ASSERT_EQ(checked(0), "true");
+}
+
+#if __cplusplus >= 201703L
+TEST_F(CheckCallTest, testChecked) {
+    constexpr Checked<&some_func_with_error_code_noexcept, IsZeroReturnCheckPolicy,
+                      ErrorCodeErrorPolicy>
+            checked{};
+    ASSERT_EQ(checked(0), 0);
+    ASSERT_CALLED(MockAPI::instance().someFuncWithErrorCode());
+    ASSERT_THROW(checked(-EINVAL), ErrnoError);
+}
+#endif
+
+static_assert(std::is_empty<CheckedSomeFunc>::value, "CheckedFunction should be stateless");
+
+static_assert(std::is_same<decltype(std::declval<CheckedSomeFunc>()(0)), int>::value,
+              "CheckedFunction should return the return type of the function");
+
+/**
+ * Tests for the ReturnValueError exception.
+ */
+TEST(ReturnValueErrorTest, testIsThrownByReportReturnValueErrorPolicy) {
+    ASSERT_THROW((callChecked<IsZeroReturnCheckPolicy, ReportReturnValueErrorPolicy>(
+                         some_func_with_error_code, 1)),
+                 ReturnValueError);
+}
+
+TEST(ReturnValueErrorTest, testMessage) {
+    enum class Code : short { ERROR = -3 };
+    struct NotFormattable {};
+
+    ASSERT_EQ(std::string(ReturnValueError{-17L}.what()), "Return value indicated error: -17");
+    ASSERT_EQ(std::string(ReturnValueError{17U}.what()), "Return value indicated error: 17");
+    ASSERT_EQ(std::string(ReturnValueError{Code::ERROR}.what()),
+              "Return value indicated error: -3");
+    ASSERT_EQ(std::string(ReturnValueError{1.5}.what()), "Return value indicated error: 1.5");
+    ASSERT_EQ(std::string(ReturnValueError{NotFormattable{}}.what()),
+              "Return value indicated error");
+}
+
+TEST(ReturnValueErrorTest, testPointerMessage) {
+    int x{0};
+    char expected[64];
+    std::snprintf(expected, sizeof(expected), "Return value indicated error: %p",
+                  static_cast<void *>(&x));
+    ASSERT_EQ(std::string(ReturnValueError{&x}.what()), expected);
+}
+
+TEST(ReturnValueErrorTest, testWhatIsStable) {
+    const ReturnValueError error{42};
+    const char *message = error.what();
+    ASSERT_EQ(message, error.what());
+    ASSERT_EQ(std::string(message), "Return value indicated error: 42");
+}
+
+/**
+ * Tests for the ErrnoError exception.
+ */
+TEST(ErrnoErrorTest, testErrnoErrorPolicyThrowsErrnoError) {
+    auto func = [](int x) {
+        errno = EACCES;
+        return x;
+    };
+    try {
+        callChecked<IsNotNegativeReturnCheckPolicy, ErrnoErrorPolicy>(func, -1);
+    } catch (const ErrnoError &e) {
+        ASSERT_EQ(e.code(), std::errc::permission_denied);
+        ASSERT_EQ(&e.code().category(), &std::generic_category());
+        ASSERT_EQ(std::string(e.what()), std::string(std::strerror(EACCES)));
+        return;
+    }
+    FAIL() << "Execution should not reach this line";
+}
+
+TEST(ErrnoErrorTest, testErrorCodeErrorPolicyThrowsErrnoError) {
+    try {
+        callChecked<IsNotNegativeReturnCheckPolicy, ErrorCodeErrorPolicy>(some_func_with_error_code,
+                                                                          -ENOENT);
+    } catch (const ErrnoError &e) {
+        ASSERT_EQ(e.code(), std::errc::no_such_file_or_directory);
+        return;
+    }
+    FAIL() << "Execution should not reach this line";
+}
+
+TEST(ErrnoErrorTest, testIsSystemError) {
+    try {
+        callChecked<IsNotNegativeReturnCheckPolicy, ErrorCodeErrorPolicy>(some_func_with_error_code,
+                                                                          -EBADF);
+    } catch (const std::system_error &e) {
+        ASSERT_EQ(e.code(), std::errc::bad_file_descriptor);
+        return;
+    }
+    FAIL() << "Execution should not reach this line";
+}
+
+TEST(ErrnoErrorTest, testUnknownError) {
+    const ErrnoError error{123456};
+    ASSERT_NE(std::string(error.what()), "");
+    ASSERT_EQ(error.what(), error.what());
+}
+
+TEST(ErrnoErrorTest, testCopyAfterWhat) {
+    std::unique_ptr<ErrnoError> original{new ErrnoError{ENOENT}};
+    ASSERT_EQ(std::string(original->what()), std::strerror(ENOENT));
+    const ErrnoError copy{*original};
+    ErrnoError assigned{EINVAL};
+    assigned.what();
+    assigned = *original;
+    original.reset();
+    ASSERT_EQ(std::string(copy.what()), std::strerror(ENOENT));
+    ASSERT_EQ(std::string(assigned.what()), std::strerror(ENOENT));
+    ASSERT_EQ(assigned.code(), std::errc::no_such_file_or_directory);
+}
+
+TEST(ErrnoErrorTest, testConcurrentErrors) {
+    const std::vector<int> errors{EINVAL, ENOENT, EACCES, EAGAIN};
+    std::vector<std::string> expectedMessages{};
+    for (const int error : errors) {
+        expectedMessages.emplace_back(std::strerror(error));
+    }
+
+    std::vector<char> allCorrect(errors.size(), false);  // not vector<bool>: written concurrently
+    std::vector<std::thread> threads{};
+    for (std::size_t i = 0; i < errors.size(); i++) {
+        threads.emplace_back([&, i]() {
+            auto func = [&](int x) {
+                errno = errors[i];
+                return x;
+            };
+            bool correct{true};
+            for (int j = 0; j < 1000; j++) {
+                try {
+                    callChecked<IsNotNegativeReturnCheckPolicy, ErrnoErrorPolicy>(func, -1);
+                    correct = false;
+                } catch (const ErrnoError &e) {
+                    correct = correct && e.code().value() == errors[i] &&
+                              e.what() == expectedMessages[i];
+                }
+            }
+            allCorrect[i] = correct;
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (std::size_t i = 0; i < errors.size(); i++) {
+        ASSERT_TRUE(allCorrect[i]) << "Wrong error reported for errno " << errors[i];
+    }
+}
+
+/**
+ * Checked calls that succeed must not allocate, and neither must failed calls
+ * that report errors as values.
+ */
+TEST(CheckCallAllocationTest, testSuccessDoesNotAllocate) {
+    int called{0};
+    ASSERT_NO_ALLOCATION(callChecked<IsNotNegativeReturnCheckPolicy>(
+            c_api_some_func_with_error_code, 1, &called));
+    ASSERT_NO_ALLOCATION(callChecked<IsZeroReturnCheckPolicy, ErrorCodeErrorPolicy>(
+            c_api_some_func_with_error_code, 0, &called));
+    ASSERT_NO_ALLOCATION(CallCheckContext<IsNotZeroReturnCheckPolicy>::callChecked(
+            c_api_some_func_with_error_code, 1, &called));
+    ASSERT_NO_ALLOCATION(callChecked<IsNotNullptrReturnCheckPolicy>(
+            c_api_some_func_returning_pointer, &called));
+    ASSERT_EQ(called, 3);
+}
+
+TEST(CheckCallAllocationTest, testCheckedFunctionDoesNotAllocate) {
+    constexpr CheckedFunction<decltype(&c_api_some_func_with_error_code),
+                              &c_api_some_func_with_error_code, IsNotNegativeReturnCheckPolicy>
+            checked{};
+    ASSERT_NO_ALLOCATION(checked(17, nullptr));
+}
+
+TEST(CheckCallAllocationTest, testExpectedErrorPolicyDoesNotAllocate) {
+    using ct = CallCheckContext<IsNotNegativeReturnCheckPolicy,
+                                ExpectedErrorPolicy<NegatedReturnValueErrorSource>>;
+    ASSERT_NO_ALLOCATION(ASSERT_TRUE(ct::callChecked(c_api_some_func_with_error_code, 1, nullptr)));
+    ASSERT_NO_ALLOCATION(
+            ASSERT_FALSE(ct::callChecked(c_api_some_func_with_error_code, -EINTR, nullptr)));
+}
+
+TEST(CheckCallAllocationTest, testCounterDetectsAllocations) {
+    ::cppc::testing::AllocationCounter counter{};
+    {
+        std::unique_ptr<int> value{new int{17}};
+        ASSERT_EQ(*value, 17);
+    }
+    ASSERT_EQ(counter.allocations(), 1u);
+}
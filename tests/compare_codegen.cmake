@@ -0,0 +1,68 @@
+#   Copyright 2016-2019 Marcus Gelderie
+#
+#   Licensed under the Apache License, Version 2.0 (the "License");
+#   you may not use this file except in compliance with the License.
+#   You may obtain a copy of the License at
+#
+#       http://www.apache.org/licenses/LICENSE-2.0
+#
+#   Unless required by applicable law or agreed to in writing, software
+#   distributed under the License is distributed on an "AS IS" BASIS,
+#   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#   See the License for the specific language governing permissions and
+#   limitations under the License.
+
+# Compares the generated code of pairs of functions in an assembly file.
+#
+# For every function 'cppc_codegen_actual_<name>' in ASM_FILE, the instructions
+# must be identical to those of 'cppc_codegen_expected_<name>'. Directives,
+# comments and the numbering of local labels are ignored.
+#
+# usage: cmake -DASM_FILE=<file.s> -P compare_codegen.cmake
+
+if (NOT DEFINED ASM_FILE)
+    message(FATAL_ERROR "ASM_FILE not set")
+endif (NOT DEFINED ASM_FILE)
+
+file(STRINGS ${ASM_FILE} _lines)
+
+# Collect the normalized instructions of every function, keyed by its name.
+set(_current "")
+set(_functions "")
+foreach (_line IN LISTS _lines)
+    if (_line MATCHES "^(cppc_codegen_[a-z_]+):")
+        set(_current ${CMAKE_MATCH_1})
+        list(APPEND _functions ${_current})
+        set(_body_${_current} "")
+    elseif (_line MATCHES "^[^ \t.]" OR _line MATCHES "^[ \t]*\\.cfi_endproc")
+        set(_current "")
+    elseif (_current AND NOT _line MATCHES "^[ \t]*(\\.|#|$)")
+        string(REGEX REPLACE "[#;].*$" "" _line "${_line}")
+        string(REGEX REPLACE "\\.L[A-Za-z_]*[0-9]+" ".L" _line "${_line}")
+        string(STRIP "${_line}" _line)
+        string(REGEX REPLACE "[ \t]+" " " _line "${_line}")
+        list(APPEND _body_${_current} "${_line}")
+    endif ()
+endforeach ()
+
+set(_compared 0)
+foreach (_function IN LISTS _functions)
+    if (_function MATCHES "^cppc_codegen_actual_(.+)$")
+        set(_expected cppc_codegen_expected_${CMAKE_MATCH_1})
+        if (NOT DEFINED _body_${_expected})
+            message(FATAL_ERROR "${_function} has no counterpart ${_expected}")
+        endif ()
+        if (NOT "${_body_${_function}}" STREQUAL "${_body_${_expected}}")
+            string(REPLACE ";" "\n  " _actual_code "${_body_${_function}}")
+            string(REPLACE ";" "\n  " _expected_code "${_body_${_expected}}")
+            message(FATAL_ERROR "Code of ${_function} differs from ${_expected}.\n"
+                                "expected:\n  ${_expected_code}\nactual:\n  ${_actual_code}")
+        endif ()
+        math(EXPR _compared "${_compared} + 1")
+    endif ()
+endforeach ()
+
+if (_compared EQUAL 0)
+    message(FATAL_ERROR "No functions to compare in ${ASM_FILE}")
+endif ()
+message(STATUS "${_compared} function(s) compile to the expected code")
@@ -0,0 +1,263 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "boundedqueue.hpp"
+#include "deferredfree.hpp"
+
+using namespace ::cppc;
+
+namespace {
+
+/**
+ * Records the values of the freed handles and the threads that freed them.
+ */
+struct FreeLog {
+    std::mutex mutex{};
+    std::vector<std::pair<int, std::thread::id>> freed{};
+
+    void record(int value) {
+        std::lock_guard<std::mutex> lock{mutex};
+        freed.emplace_back(value, std::this_thread::get_id());
+    }
+
+    std::size_t size() {
+        std::lock_guard<std::mutex> lock{mutex};
+        return freed.size();
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock{mutex};
+        freed.clear();
+    }
+};
+
+FreeLog freeLog{};
+
+void log_free(int *ptr) noexcept { freeLog.record(*ptr); }
+
+constexpr int BLOCKING_VALUE{-1};
+std::atomic<bool> blocking{false};
+std::atomic<bool> unblock{false};
+
+/**
+ * Like log_free, but blocks after freeing BLOCKING_VALUE until unblocked.
+ */
+void log_free_blocking(int *ptr) noexcept {
+    freeLog.record(*ptr);
+    if (*ptr == BLOCKING_VALUE) {
+        blocking = true;
+        while (!unblock) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+using LogFree = FreeFunction<decltype(&log_free), &log_free>;
+using DeferredGuard = Guard<int *, DeferredFree<LogFree>>;
+
+using BlockingGuard =
+        Guard<int *, DeferredFree<FreeFunction<decltype(&log_free_blocking), &log_free_blocking>, 2>>;
+
+class DeferredFreeTest : public ::testing::Test {
+public:
+    void SetUp() override {
+        flushDeferredFrees();
+        freeLog.clear();
+    }
+};
+
+}  // namespace
+
+TEST(BoundedMpscQueueTest, testFifoAndCapacity) {
+    BoundedMpscQueue<int, 4> queue{};
+    int value{0};
+    ASSERT_FALSE(queue.tryPop(value));
+    for (int i = 0; i < 4; i++) {
+        ASSERT_TRUE(queue.tryPush(i));
+    }
+    ASSERT_FALSE(queue.tryPush(4));
+    ASSERT_EQ(queue.size(), 4u);
+    for (int i = 0; i < 4; i++) {
+        ASSERT_TRUE(queue.tryPop(value));
+        ASSERT_EQ(value, i);
+        ASSERT_TRUE(queue.tryPush(i + 4));
+    }
+    for (int i = 4; i < 8; i++) {
+        ASSERT_TRUE(queue.tryPop(value));
+        ASSERT_EQ(value, i);
+    }
+    ASSERT_FALSE(queue.tryPop(value));
+    ASSERT_EQ(queue.size(), 0u);
+}
+
+TEST(BoundedMpscQueueTest, testConcurrentProducers) {
+    constexpr int numProducers{4};
+    constexpr int valuesPerProducer{20000};
+    BoundedMpscQueue<std::pair<int, int>, 64> queue{};
+    std::vector<std::thread> producers{};
+    for (int p = 0; p < numProducers; p++) {
+        producers.emplace_back([&queue, p]() {
+            for (int i = 0; i < valuesPerProducer; i++) {
+                while (!queue.tryPush(std::make_pair(p, i))) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    std::vector<int> next(numProducers, 0);
+    std::pair<int, int> value{};
+    for (int received = 0; received < numProducers * valuesPerProducer;) {
+        if (queue.tryPop(value)) {
+            // values of a single producer arrive in order
+            ASSERT_EQ(value.second, next[value.first]);
+            next[value.first]++;
+            received++;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    for (auto &producer : producers) {
+        producer.join();
+    }
+    ASSERT_EQ(next, std::vector<int>(numProducers, valuesPerProducer));
+}
+
+TEST_F(DeferredFreeTest, testFreesOnBackgroundThread) {
+    int value{17};
+    { DeferredGuard guard{&value}; }
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{10};
+    while (freeLog.size() == 0 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+    ASSERT_EQ(freeLog.size(), 1u);
+    ASSERT_EQ(freeLog.freed[0].first, 17);
+    ASSERT_NE(freeLog.freed[0].second, std::this_thread::get_id());
+}
+
+TEST_F(DeferredFreeTest, testFlush) {
+    std::vector<int> values(100);
+    for (std::size_t i = 0; i < values.size(); i++) {
+        values[i] = static_cast<int>(i);
+        DeferredGuard guard{&values[i]};
+    }
+    flushDeferredFrees();
+    ASSERT_EQ(freeLog.size(), values.size());
+}
+
+TEST_F(DeferredFreeTest, testMovedFromGuardIsNotQueued) {
+    int value{3};
+    {
+        DeferredGuard guard{&value};
+        DeferredGuard another{std::move(guard)};
+        ASSERT_EQ(guard.get(), nullptr);
+    }
+    flushDeferredFrees();
+    ASSERT_EQ(freeLog.size(), 1u);
+    ASSERT_EQ(freeLog.freed[0].first, 3);
+}
+
+TEST_F(DeferredFreeTest, testFullQueueFreesOnCallingThread) {
+    int values[]{BLOCKING_VALUE, 1, 2, 3};
+    blocking = false;
+    unblock = false;
+    // occupy the background thread
+    { BlockingGuard guard{&values[0]}; }
+    while (!blocking) {
+        std::this_thread::yield();
+    }
+    // fill the queue
+    { BlockingGuard guard{&values[1]}; }
+    { BlockingGuard guard{&values[2]}; }
+    ASSERT_EQ(freeLog.size(), 1u);
+    // no room left
+    { BlockingGuard guard{&values[3]}; }
+    ASSERT_EQ(freeLog.size(), 2u);
+    ASSERT_EQ(freeLog.freed[1].first, 3);
+    ASSERT_EQ(freeLog.freed[1].second, std::this_thread::get_id());
+
+    unblock = true;
+    flushDeferredFrees();
+    ASSERT_EQ(freeLog.size(), 4u);
+}
+
+TEST_F(DeferredFreeTest, testConcurrentGuards) {
+    constexpr int numThreads{4};
+    constexpr int guardsPerThread{20000};
+    std::vector<int> values(numThreads * guardsPerThread, 1);
+    std::vector<std::thread> threads{};
+    for (int t = 0; t < numThreads; t++) {
+        threads.emplace_back([&values, t]() {
+            for (int i = 0; i < guardsPerThread; i++) {
+                DeferredGuard guard{&values[t * guardsPerThread + i]};
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    flushDeferredFrees();
+    ASSERT_EQ(freeLog.size(), values.size());
+}
+
+namespace {
+
+// trivially destructible, so that threads may free handles while the program exits
+std::atomic<int> exitFrees{0};
+
+void count_free(int *) noexcept { exitFrees.fetch_add(1, std::memory_order_relaxed); }
+
+using CountingGuard = Guard<int *, DeferredFree<FreeFunction<decltype(&count_free), &count_free>>>;
+
+}  // namespace
+
+TEST(DeferredFreeDeathTest, testGuardsDestroyedDuringExit) {
+    ::testing::FLAGS_gtest_death_test_style = "threadsafe";
+    ASSERT_EXIT(
+            {
+                static int value{0};
+                std::thread{[]() {
+                    while (true) {
+                        CountingGuard guard{&value};
+                    }
+                }}.detach();
+                while (exitFrees.load(std::memory_order_relaxed) == 0) {
+                    std::this_thread::yield();
+                }
+                std::exit(0);
+            },
+            ::testing::ExitedWithCode(0), "");
+}
+
+static_assert(sizeof(DeferredGuard) == sizeof(int *),
+              "Guard with DeferredFree should be as large as the guarded pointer");
+
+static_assert(noexcept(std::declval<DeferredGuard>().~Guard()),
+              "Guard with DeferredFree should have a noexcept destructor");
+
+static_assert(_auxiliary::OnlyFreesMemory<DeferredFree<OnlyFreesMemoryPolicy<LogFree>>>::value &&
+                      !_auxiliary::OnlyFreesMemory<DeferredFree<LogFree>>::value,
+              "DeferredFree should only free memory if the policy it defers does");
@@ -0,0 +1,188 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "async.hpp"
+#include "checkcall.hpp"
+#include "executor.hpp"
+#include "test_api.h"
+
+using namespace ::cppc;
+using namespace ::cppc::testing::mock;
+using namespace ::cppc::testing::mock::api;
+using namespace ::cppc::testing::assertions;
+
+TEST(ExecutorTest, testSubmit) {
+    Executor executor{2};
+    auto future = executor.submit([]() { return 17; });
+    ASSERT_EQ(future.get(), 17);
+}
+
+TEST(ExecutorTest, testSubmitFromManyThreads) {
+    constexpr int numThreads{4};
+    constexpr int numTasks{250};
+    std::atomic<int> numRun{0};
+    {
+        Executor executor{3, 16};
+        std::vector<std::thread> threads{};
+        for (int t = 0; t < numThreads; t++) {
+            threads.emplace_back([&executor, &numRun]() {
+                std::vector<CallFuture<void>> futures{};
+                for (int i = 0; i < numTasks; i++) {
+                    futures.push_back(executor.submit([&numRun]() { numRun++; }));
+                }
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        ASSERT_EQ(numRun.load(), numThreads * numTasks);
+    }
+}
+
+TEST(ExecutorTest, testFutureWaitsWhenDestroyed) {
+    Executor executor{1};
+    int outParameter{0};
+    {
+        auto future = executor.submit([&outParameter]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds{20});
+            outParameter = 17;
+        });
+    }
+    ASSERT_EQ(outParameter, 17);
+}
+
+TEST(ExecutorTest, testSubmitBlocksIfFull) {
+    Executor executor{1, 1};
+    std::promise<void> started{};
+    std::promise<void> release{};
+    std::shared_future<void> released{release.get_future().share()};
+    auto blocking = executor.submit([&started, released]() {
+        started.set_value();
+        released.wait();
+    });
+    started.get_future().wait();
+    auto queued = executor.submit([]() { return 1; });
+
+    std::atomic<bool> submitted{false};
+    std::thread submitter{[&executor, &submitted]() {
+        auto future = executor.submit([]() {});
+        submitted = true;
+    }};
+    std::this_thread::sleep_for(std::chrono::milliseconds{20});
+    ASSERT_FALSE(submitted.load());
+
+    release.set_value();
+    submitter.join();
+    ASSERT_TRUE(submitted.load());
+    ASSERT_EQ(queued.get(), 1);
+}
+
+TEST(ExecutorTest, testIdleWorkerStealsTasks) {
+    Executor executor{2};
+    auto outer = executor.submit([&executor]() {
+        // the inner task is queued on this worker, which then blocks
+        auto inner = executor.submit([]() { return 17; });
+        return inner.get();
+    });
+    ASSERT_EQ(outer.get(), 17);
+}
+
+TEST(ExecutorTest, testWorkerSubmittingToFullExecutorRunsTaskInline) {
+    Executor executor{2, 1};
+    std::promise<void> started{};
+    std::promise<void> release{};
+    std::shared_future<void> released{release.get_future().share()};
+    auto blocking = executor.submit([&started, released]() {
+        started.set_value();
+        released.wait();
+    });
+    started.get_future().wait();
+
+    auto outer = executor.submit([&executor, &release]() {
+        const auto outerThread = std::this_thread::get_id();
+        auto first = executor.submit([]() {});  // fills the queue
+        auto second = executor.submit([]() { return std::this_thread::get_id(); });
+        const bool ranInline{second.waitFor(std::chrono::seconds{0}) ==
+                             std::future_status::ready};
+        const bool ranOnThisThread{second.get() == outerThread};
+        // let the other worker steal the first task
+        release.set_value();
+        return ranInline && ranOnThisThread;
+    });
+    ASSERT_TRUE(outer.get());
+}
+
+class CallCheckedAsyncTest : public ::testing::Test {
+public:
+    void SetUp() override { MockAPI::instance().reset(); }
+};
+
+TEST_F(CallCheckedAsyncTest, testReturnsValue) {
+    Executor executor{2};
+    auto future = callCheckedAsync<IsNotNegativeReturnCheckPolicy>(executor,
+                                                                   some_func_with_error_code, 17);
+    ASSERT_EQ(future.get(), 17);
+    ASSERT_CALLED(MockAPI::instance().someFuncWithErrorCode());
+}
+
+TEST_F(CallCheckedAsyncTest, testRethrowsError) {
+    Executor executor{2};
+    auto future = callCheckedAsync<IsNotNegativeReturnCheckPolicy, ReportReturnValueErrorPolicy>(
+            executor, some_func_with_error_code, -3);
+    ASSERT_THROW(future.get(), ReturnValueError);
+}
+
+TEST_F(CallCheckedAsyncTest, testDefaultExecutor) {
+    auto &executor = Executor::instance();
+    int called{0};
+    auto future = callCheckedAsync<IsNotZeroReturnCheckPolicy, ErrorCodeErrorPolicy>(
+            executor, c_api_some_func_with_error_code, 17, &called);
+    ASSERT_EQ(future.get(), 17);
+    ASSERT_EQ(called, 1);
+    ASSERT_THROW((callCheckedAsync<IsNotZeroReturnCheckPolicy, ErrorCodeErrorPolicy>(
+                          executor, c_api_some_func_with_error_code, 0, &called)
+                          .get()),
+                 ErrnoError);
+}
+
+TEST_F(CallCheckedAsyncTest, testArgumentsByReference) {
+    Executor executor{1};
+    int value{0};
+    auto assign = [](int &target, int source) {
+        target = source;
+        return 0;
+    };
+    callCheckedAsync(executor, assign, std::ref(value), 17).get();
+    ASSERT_EQ(value, 17);
+}
+
+TEST_F(CallCheckedAsyncTest, testMoveOnlyArguments) {
+    Executor executor{1};
+    auto future = callCheckedAsync<IsNotNullptrReturnCheckPolicy>(
+            executor, [](std::unique_ptr<int> ptr) { return ptr; }, std::make_unique<int>(17));
+    ASSERT_EQ(*future.get(), 17);
+}
@@ -0,0 +1,53 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+/*
+ * This file is not linked into any test. It is compiled to assembly and the
+ * functions prefixed with 'cppc_codegen_expected_' are compared to their
+ * counterparts prefixed with 'cppc_codegen_actual_' (see compare_codegen.cmake).
+ */
+
+#include "guard.hpp"
+
+extern "C" {
+
+struct codegen_handle;
+
+void codegen_handle_free(codegen_handle *);
+
+using CodegenHandleGuard =
+        cppc::Guard<codegen_handle *,
+                    cppc::FreeFunction<decltype(&codegen_handle_free), &codegen_handle_free>>;
+
+void cppc_codegen_expected_release(codegen_handle *handle) {
+    if (handle != nullptr) {
+        codegen_handle_free(handle);
+    }
+}
+
+void cppc_codegen_actual_release(codegen_handle *handle) { CodegenHandleGuard guard{handle}; }
+
+void cppc_codegen_expected_move_and_release(codegen_handle *handle) {
+    if (handle != nullptr) {
+        codegen_handle_free(handle);
+    }
+}
+
+void cppc_codegen_actual_move_and_release(codegen_handle *handle) {
+    CodegenHandleGuard guard{handle};
+    CodegenHandleGuard another{std::move(guard)};
+}
+}
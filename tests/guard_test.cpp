@@ -14,18 +14,25 @@
  *
  */
 
+#include <algorithm>
+#include <array>
+#include <cstdlib>
 #include <memory>
+#include <thread>
+#include <vector>
 
 #include "gtest/gtest.h"
 
 #include "cppc.hpp"
 
+#include "allocation_counter.h"
 #include "test_api.h"
 
 using namespace ::cppc;
 using namespace ::cppc::testing::mock;
 using namespace ::cppc::testing::mock::api;
 using namespace ::cppc::testing::assertions;
+using ::cppc::testing::AllocationCounter;
 
 template <class T = DefaultFreePolicy<some_type_t>, class S = ByValueStoragePolicy<some_type_t>>
 using GuardT = Guard<some_type_t, T, S>;
@@ -108,6 +115,139 @@ TEST_F(GuardFreeFuncTest, testWithUniquePointer) {
     ASSERT_CALLED(MockAPI::instance().releaseResourcesFunc());
 }
 
+using PooledGuardT = GuardT<CustomDeleterT, PooledStoragePolicy<some_type_t>>;
+
+TEST_F(GuardFreeFuncTest, testWithPooledStorage) {
+    {
+        PooledGuardT guard{};
+        ASSERT_NOT_CALLED(MockAPI::instance().releaseResourcesFunc());
+        do_init_work(&guard.get());
+        ASSERT_NOT_CALLED(MockAPI::instance().releaseResourcesFunc());
+    }
+    ASSERT_NUM_CALLED(MockAPI::instance().releaseResourcesFunc(), 1);
+}
+
+TEST_F(GuardFreeFuncTest, testPooledStorageReusesBlocks) {
+    const some_type_t *address{nullptr};
+    {
+        PooledGuardT guard{};
+        address = &guard.get();
+    }
+    PooledGuardT guard{};
+    ASSERT_EQ(&guard.get(), address);
+}
+
+TEST_F(GuardFreeFuncTest, testPooledStorageMoveKeepsAddress) {
+    {
+        PooledGuardT guard{};
+        const some_type_t *address{&guard.get()};
+        PooledGuardT another{std::move(guard)};
+        ASSERT_EQ(&another.get(), address);
+        ASSERT_NOT_CALLED(MockAPI::instance().releaseResourcesFunc());
+    }
+    ASSERT_NUM_CALLED(MockAPI::instance().releaseResourcesFunc(), 1);
+}
+
+TEST_F(GuardFreeFuncTest, testPooledStorageAcrossThreads) {
+    constexpr unsigned int numGuards{200};
+    std::vector<PooledGuardT> guards(numGuards);
+    std::vector<const some_type_t *> addresses{};
+    for (const auto &guard : guards) {
+        addresses.push_back(&guard.get());
+    }
+    std::sort(addresses.begin(), addresses.end());
+    ASSERT_EQ(std::unique(addresses.begin(), addresses.end()), addresses.end());
+
+    // free the blocks on another thread, which hands them back when it exits
+    std::thread{[guards = std::move(guards)]() mutable { guards.clear(); }}.join();
+    ASSERT_NUM_CALLED(MockAPI::instance().releaseResourcesFunc(), numGuards);
+
+    std::thread{[]() {
+        PooledGuardT guard{};
+        do_init_work(&guard.get());
+    }}.join();
+    ASSERT_NUM_CALLED(MockAPI::instance().releaseResourcesFunc(), numGuards + 1);
+}
+
+/**
+ * Holds a pooled Guard in a thread_local that is constructed before (and
+ * hence destroyed after) the thread's slab allocator.
+ */
+struct LatePooledGuards {
+    std::unique_ptr<PooledGuardT> guard{};
+
+    ~LatePooledGuards() {
+        guard.reset();
+        PooledGuardT another{};
+        do_init_work(&another.get());
+    }
+};
+
+TEST_F(GuardFreeFuncTest, testPooledStorageAfterThreadAllocatorIsDestroyed) {
+    std::thread{[]() {
+        thread_local LatePooledGuards late{};
+        late.guard.reset(new PooledGuardT{});
+    }}.join();
+    ASSERT_NUM_CALLED(MockAPI::instance().releaseResourcesFunc(), 2);
+}
+
+TEST(SlabAllocatorTest, testProducerConsumerSlabsStayBounded) {
+    // a block layout no other test uses, so that the depot is not shared
+    using Allocator = _auxiliary::SlabAllocator<200, 8>;
+    constexpr std::size_t numBlocks{100000};
+    BoundedMpscQueue<void *, 256> queue{};
+    std::thread consumer{[&queue]() {
+        void *block{nullptr};
+        for (std::size_t freed = 0; freed < numBlocks;) {
+            if (queue.tryPop(block)) {
+                Allocator::deallocateBlock(block);
+                freed++;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }};
+    for (std::size_t i = 0; i < numBlocks; i++) {
+        void *block{Allocator::allocateBlock()};
+        while (!queue.tryPush(block)) {
+            std::this_thread::yield();
+        }
+    }
+    consumer.join();
+    // the blocks in the queue and in both threads' free lists, with some slack
+    ASSERT_LE(Allocator::Depot::instance().numSlabs(), 16u);
+}
+
+/**
+ * A C struct that is too large to be stored inline.
+ */
+struct large_type_t {
+    char data[256];
+};
+
+void release_large(large_type_t &) noexcept {}
+
+TEST_F(GuardFreeFuncTest, testInlineOrHeapStorageInline) {
+    {
+        GuardT<CustomDeleterT, InlineOrHeapStoragePolicy<some_type_t, 16>> guard{};
+        const char *value{reinterpret_cast<const char *>(&guard.get())};
+        const char *begin{reinterpret_cast<const char *>(&guard)};
+        ASSERT_TRUE(value >= begin && value < begin + sizeof(guard));
+        do_init_work(&guard.get());
+        ASSERT_NOT_CALLED(MockAPI::instance().releaseResourcesFunc());
+    }
+    ASSERT_NUM_CALLED(MockAPI::instance().releaseResourcesFunc(), 1);
+}
+
+TEST_F(GuardFreeFuncTest, testInlineOrHeapStorageHeapMoveKeepsAddress) {
+    using LargeGuard = Guard<large_type_t, void (*)(large_type_t &),
+                             InlineOrHeapStoragePolicy<large_type_t, 64>>;
+    LargeGuard guard{&release_large};
+    const large_type_t *address{&guard.get()};
+    LargeGuard another{std::move(guard)};
+    ASSERT_EQ(&another.get(), address);
+}
+
 /**
  * DefaultFreePolicy is essentially a std::function<void(T&)> (with some
  * different type in case of pointers). This type is default-constructible, but
@@ -126,6 +266,104 @@ TEST_F(GuardFreeFuncTest, testThatDefaulFreePolicyThrowsIfEmpty) {
     ASSERT_THROW(delete guard, std::bad_function_call);
 }
 
+using FreeResourcesPolicy = FreeFunction<decltype(&free_resources), &free_resources>;
+
+TEST_F(GuardFreeFuncTest, testFreeFunctionPolicy) {
+    {
+        Guard<some_type_t *, FreeResourcesPolicy> guard{create_and_initialize()};
+        ASSERT_NOT_CALLED(MockAPI::instance().freeResourcesFunc());
+    }
+    ASSERT_NUM_CALLED(MockAPI::instance().freeResourcesFunc(), 1);
+}
+
+TEST_F(GuardFreeFuncTest, testFreeFunctionPolicyMove) {
+    {
+        Guard<some_type_t *, FreeResourcesPolicy> guard{create_and_initialize()};
+        Guard<some_type_t *, FreeResourcesPolicy> another{std::move(guard)};
+        ASSERT_EQ(guard.get(), nullptr);
+        ASSERT_EQ(another.get(), create_and_initialize());
+        guard = std::move(another);
+        ASSERT_NOT_CALLED(MockAPI::instance().freeResourcesFunc());
+    }
+    ASSERT_NUM_CALLED(MockAPI::instance().freeResourcesFunc(), 1);
+}
+
+TEST_F(GuardFreeFuncTest, testFreeFunctionPolicyDoesNotFreeNullptr) {
+    { Guard<some_type_t *, FreeResourcesPolicy> guard{nullptr}; }
+    ASSERT_NOT_CALLED(MockAPI::instance().freeResourcesFunc());
+}
+
+#if __cplusplus >= 201703L
+TEST_F(GuardFreeFuncTest, testFreeWith) {
+    { Guard<some_type_t *, FreeWith<&free_resources>> guard{create_and_initialize()}; }
+    ASSERT_NUM_CALLED(MockAPI::instance().freeResourcesFunc(), 1);
+}
+#endif
+
+/**
+ * A FreePolicy for file-descriptor-like handles that records which
+ * descriptors it has closed.
+ */
+struct CloseDescriptor {
+    static std::vector<int> closed;
+
+    void operator()(int fd) const noexcept { closed.push_back(fd); }
+};
+
+std::vector<int> CloseDescriptor::closed{};
+
+using DescriptorGuard = Guard<int, WithNullValue<CloseDescriptor, int, -1>>;
+
+class GuardNullValueTest : public ::testing::Test {
+public:
+    void SetUp() override { CloseDescriptor::closed.clear(); }
+};
+
+TEST_F(GuardNullValueTest, testDefaultConstructedHoldsNullValue) {
+    {
+        DescriptorGuard guard{};
+        ASSERT_EQ(guard.get(), -1);
+    }
+    ASSERT_TRUE(CloseDescriptor::closed.empty());
+}
+
+TEST_F(GuardNullValueTest, testOutParameter) {
+    {
+        DescriptorGuard guard{};
+        guard.get() = 3;  // as if an API had written to &guard.get()
+    }
+    ASSERT_EQ(CloseDescriptor::closed, std::vector<int>{3});
+}
+
+TEST_F(GuardNullValueTest, testMoveLeavesNullValue) {
+    {
+        DescriptorGuard guard{0};
+        DescriptorGuard another{std::move(guard)};
+        ASSERT_EQ(guard.get(), -1);
+        ASSERT_EQ(another.get(), 0);
+        ASSERT_TRUE(CloseDescriptor::closed.empty());
+        another = DescriptorGuard{1};
+        ASSERT_EQ(CloseDescriptor::closed, std::vector<int>{0});
+    }
+    ASSERT_EQ(CloseDescriptor::closed, (std::vector<int>{0, 1}));
+}
+
+TEST_F(GuardNullValueTest, testVectorOfGuards) {
+    constexpr int numDescriptors{100};
+    {
+        std::vector<DescriptorGuard> guards{};
+        for (int fd = 0; fd < numDescriptors; fd++) {
+            guards.emplace_back(fd);
+        }
+        ASSERT_TRUE(CloseDescriptor::closed.empty());
+    }
+    ASSERT_EQ(CloseDescriptor::closed.size(), static_cast<std::size_t>(numDescriptors));
+    std::sort(CloseDescriptor::closed.begin(), CloseDescriptor::closed.end());
+    for (int fd = 0; fd < numDescriptors; fd++) {
+        ASSERT_EQ(CloseDescriptor::closed[fd], fd);
+    }
+}
+
 class GuardMemoryMngmtTest : public ::testing::Test {
 public:
     void SetUp() override {
@@ -221,6 +459,128 @@ TEST_F(GuardMemoryMngmtTest, testMoveAssignment) {
     ASSERT_NUM_CALLED(MockAPI::instance().releaseResourcesFunc(), 2);
 }
 
+/*
+ * Allocation tests: Guards with stateless FreePolicies must not allocate when
+ * they are created, moved or destroyed. DefaultFreePolicy wraps a
+ * std::function, which allocates for functors too large for its small buffer.
+ */
+using CFreeGuard = Guard<int *, FreeFunction<decltype(&c_api_free_resource), &c_api_free_resource>>;
+
+struct DiscardDescriptor {
+    void operator()(int) const noexcept {}
+};
+
+using DiscardingDescriptorGuard = Guard<int, WithNullValue<DiscardDescriptor, int, -1>>;
+
+// SetUp creates the mock API, so that its lazy allocation is not counted
+class GuardAllocationTest : public GuardFreeFuncTest {};
+
+TEST_F(GuardAllocationTest, testFreeFunctionDoesNotAllocate) {
+    int resource{0};
+    ASSERT_NO_ALLOCATION(CFreeGuard guard{&resource});
+    ASSERT_NO_ALLOCATION(CFreeGuard guard{&resource}; CFreeGuard another{std::move(guard)};
+                         guard = std::move(another));
+}
+
+TEST_F(GuardAllocationTest, testNullValueDoesNotAllocate) {
+    ASSERT_NO_ALLOCATION(DiscardingDescriptorGuard guard{3};
+                         DiscardingDescriptorGuard another{std::move(guard)};
+                         guard = std::move(another); guard.get() = 4);
+}
+
+TEST_F(GuardAllocationTest, testStatelessFunctorDoesNotAllocate) {
+    ASSERT_NO_ALLOCATION(GuardT<CustomDeleterT> guard{};
+                         GuardT<CustomDeleterT> another{std::move(guard)});
+    ASSERT_NO_ALLOCATION(GuardT<CustomDeleterT, InlineOrHeapStoragePolicy<some_type_t, 16>> guard{});
+}
+
+TEST_F(GuardAllocationTest, testPooledStorageDoesNotAllocateOnceWarm) {
+    { PooledGuardT warmUp{}; }
+    ASSERT_NO_ALLOCATION(PooledGuardT guard{}; PooledGuardT another{std::move(guard)});
+}
+
+TEST_F(GuardAllocationTest, testDefaultFreePolicyAllocatesForLargeFunctors) {
+    const std::array<char, 64> state{};
+    AllocationCounter counter{};
+    {
+        GuardT<> guard{[state](some_type_t &) { static_cast<void>(state); }};
+    }
+    ASSERT_GT(counter.allocations(), 0u);
+}
+
+/*
+ * Fast exit: once it has begun, Guards skip releases that only free memory.
+ */
+struct CountingFree {
+    static int calls;
+
+    void operator()(int *) const noexcept { calls++; }
+};
+
+int CountingFree::calls{0};
+
+using MemoryGuard = Guard<int *, OnlyFreesMemoryPolicy<CountingFree>>;
+using SideEffectGuard = Guard<int *, CountingFree>;
+
+class GuardFastExitTest : public ::testing::Test {
+public:
+    void SetUp() override { CountingFree::calls = 0; }
+};
+
+// fast exit cannot be undone, so it begins in a child process
+class GuardFastExitDeathTest : public GuardFastExitTest {
+public:
+    void SetUp() override {
+        GuardFastExitTest::SetUp();
+        ::testing::FLAGS_gtest_death_test_style = "threadsafe";
+    }
+};
+
+TEST_F(GuardFastExitTest, testReleasesBeforeFastExit) {
+    int value{0};
+    ASSERT_FALSE(fastExitBegun());
+    { MemoryGuard guard{&value}; }
+    { SideEffectGuard guard{&value}; }
+    ASSERT_EQ(CountingFree::calls, 2);
+}
+
+TEST_F(GuardFastExitDeathTest, testSkipsMemoryOnlyReleasesAfterFastExit) {
+    ASSERT_EXIT(
+            {
+                int value{0};
+                MemoryGuard *memoryGuard{new MemoryGuard{&value}};
+                SideEffectGuard *sideEffectGuard{new SideEffectGuard{&value}};
+                beginFastExit();
+                delete memoryGuard;
+                const int memoryCalls{CountingFree::calls};
+                delete sideEffectGuard;
+                std::exit(fastExitBegun() && memoryCalls == 0 && CountingFree::calls == 1 ? 0
+                                                                                          : 1);
+            },
+            ::testing::ExitedWithCode(0), "");
+}
+
+TEST_F(GuardFastExitDeathTest, testAssignmentReleasesAfterFastExit) {
+    ASSERT_EXIT(
+            {
+                int value{0};
+                int another{1};
+                MemoryGuard guard{&value};
+                beginFastExit();
+                guard = MemoryGuard{&another};
+                std::exit(CountingFree::calls == 1 ? 0 : 1);
+            },
+            ::testing::ExitedWithCode(0), "");
+}
+
+static_assert(_auxiliary::OnlyFreesMemory<OnlyFreesMemoryPolicy<CountingFree>>::value &&
+                      !_auxiliary::OnlyFreesMemory<CountingFree>::value,
+              "OnlyFreesMemoryPolicy should declare that a policy only frees memory");
+
+static_assert(_auxiliary::OnlyFreesMemory<
+                      WithNullValue<OnlyFreesMemoryPolicy<DiscardDescriptor>, int, -1>>::value,
+              "WithNullValue should keep the declaration of the policy it adapts");
+
 /*
  * Static tests.
  *
@@ -284,3 +644,51 @@ static_assert(
 
 static_assert(!noexcept(std::declval<GuardT<void (*)(some_type_t *)>>().~Guard()),
               "Guard with function-pointer free policy should not have noexcept destructor");
+
+static_assert(std::is_empty<FreeResourcesPolicy>::value, "FreeFunction should be stateless");
+
+static_assert(sizeof(Guard<some_type_t *, FreeResourcesPolicy>) == sizeof(some_type_t *),
+              "Guard with FreeFunction should be as large as the guarded pointer");
+
+static_assert(!noexcept(std::declval<Guard<some_type_t *, FreeResourcesPolicy>>().~Guard()),
+              "Guard with FreeFunction should not have noexcept destructor if the function is "
+              "not noexcept");
+
+#if __cplusplus >= 201703L
+void some_type_free_noexcept(some_type_t *) noexcept;
+
+static_assert(noexcept(std::declval<Guard<some_type_t *, FreeWith<&some_type_free_noexcept>>>()
+                               .~Guard()),
+              "Guard with FreeFunction should have noexcept destructor if the function is "
+              "noexcept");
+#endif
+
+static_assert(sizeof(DescriptorGuard) == sizeof(int),
+              "Guard with null value and stateless FreePolicy should be as large as the guarded "
+              "value");
+
+static_assert(std::is_nothrow_move_constructible<DescriptorGuard>::value,
+              "Guard with null value should be nothrow move-constructible");
+
+static_assert(sizeof(Guard<int, WithNullValue<CloseDescriptor, int, -1>,
+                           UniquePointerStoragePolicy<int>>) > sizeof(std::unique_ptr<int>),
+              "Guard that does not store its value directly cannot use the null value");
+
+static_assert(InlineOrHeapStoragePolicy<some_type_t, 16>::isInline &&
+                      InlineOrHeapStoragePolicy<some_type_t, 16>::pinned,
+              "Small types should be stored inline and pinned");
+
+static_assert(!InlineOrHeapStoragePolicy<large_type_t, 64>::isInline &&
+                      !InlineOrHeapStoragePolicy<large_type_t, 64>::pinned,
+              "Large types should be stored on the heap");
+
+using PinnedGuardT = GuardT<CustomDeleterT, InlineOrHeapStoragePolicy<some_type_t, 16>>;
+
+static_assert(!std::is_move_constructible<PinnedGuardT>::value &&
+                      !std::is_move_assignable<PinnedGuardT>::value,
+              "Guards with pinned storage should not be movable");
+
+static_assert(sizeof(Guard<large_type_t, void (*)(large_type_t &),
+                           InlineOrHeapStoragePolicy<large_type_t, 64>>) <
+                      sizeof(large_type_t),
+              "Large types should not be stored inline");
@@ -0,0 +1,141 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#include <atomic>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "lazyguard.hpp"
+
+using namespace ::cppc;
+
+namespace {
+
+std::atomic<int> created{0};
+std::atomic<int> freed{0};
+
+/**
+ * Returns a new int with the given value, or nullptr if the value is negative.
+ */
+int *create_int(int value) {
+    created++;
+    return value < 0 ? nullptr : new int{value};
+}
+
+void free_int(int *value) noexcept {
+    freed++;
+    delete value;
+}
+
+using FreeInt = FreeFunction<decltype(&free_int), &free_int>;
+
+template <class InitPolicy = SingleThreadedInitPolicy>
+auto makeLazyInt(int value) {
+    return makeLazyGuard<FreeInt, IsNotNullptrReturnCheckPolicy, ReportReturnValueErrorPolicy,
+                         InitPolicy>(create_int, value);
+}
+
+class LazyGuardTest : public ::testing::Test {
+public:
+    void SetUp() override {
+        created = 0;
+        freed = 0;
+    }
+};
+
+}  // namespace
+
+TEST_F(LazyGuardTest, testUnusedResourceIsNeitherCreatedNorFreed) {
+    {
+        auto guard = makeLazyInt(17);
+        ASSERT_FALSE(guard.created());
+    }
+    ASSERT_EQ(created, 0);
+    ASSERT_EQ(freed, 0);
+}
+
+TEST_F(LazyGuardTest, testCreatesOnFirstGet) {
+    {
+        auto guard = makeLazyInt(17);
+        ASSERT_EQ(*guard.get(), 17);
+        ASSERT_TRUE(guard.created());
+        ASSERT_EQ(guard.get(), guard.get());
+        ASSERT_EQ(created, 1);
+        ASSERT_EQ(freed, 0);
+    }
+    ASSERT_EQ(freed, 1);
+}
+
+TEST_F(LazyGuardTest, testFailedCreationThrowsAndIsRetried) {
+    int value{-1};
+    auto guard = makeLazyGuard<FreeInt, IsNotNullptrReturnCheckPolicy>(create_int, std::ref(value));
+    ASSERT_THROW(guard.get(), ReturnValueError);
+    ASSERT_FALSE(guard.created());
+    value = 3;
+    ASSERT_EQ(*guard.get(), 3);
+    ASSERT_EQ(created, 2);
+}
+
+TEST_F(LazyGuardTest, testMove) {
+    {
+        auto guard = makeLazyInt(1);
+        auto moved = std::move(guard);
+        ASSERT_EQ(*moved.get(), 1);
+
+        auto movedAgain = std::move(moved);
+        ASSERT_TRUE(movedAgain.created());
+        ASSERT_EQ(*movedAgain.get(), 1);
+        ASSERT_EQ(created, 1);
+    }
+    ASSERT_EQ(freed, 1);
+}
+
+TEST_F(LazyGuardTest, testStatefulFreePolicy) {
+    int freedValue{0};
+    {
+        LazyGuard<int, std::function<void(int &)>, CheckedCreate<IsNotZeroReturnCheckPolicy,
+                                                                 DefaultErrorPolicy, int (*)()>>
+                guard{CheckedCreate<IsNotZeroReturnCheckPolicy, DefaultErrorPolicy, int (*)()>{
+                              []() { return 42; }},
+                      [&freedValue](int &value) { freedValue = value; }};
+        ASSERT_EQ(guard.get(), 42);
+    }
+    ASSERT_EQ(freedValue, 42);
+}
+
+TEST_F(LazyGuardTest, testThreadSafeCreatesOnce) {
+    constexpr int numThreads{8};
+    {
+        auto guard = makeLazyInt<ThreadSafeInitPolicy>(5);
+        std::vector<int *> seen(numThreads, nullptr);
+        std::vector<std::thread> threads{};
+        for (int i = 0; i < numThreads; i++) {
+            threads.emplace_back([&guard, &seen, i]() { seen[i] = guard.get(); });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        for (int *value : seen) {
+            ASSERT_EQ(value, seen[0]);
+        }
+        ASSERT_EQ(created, 1);
+    }
+    ASSERT_EQ(freed, 1);
+}
@@ -0,0 +1,149 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#include <cerrno>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "perfcounters.hpp"
+
+using namespace ::cppc;
+
+namespace {
+
+struct BusyTag {};
+struct FailingTag {};
+struct ErrnoTag {};
+
+template <class Tag>
+using ct = ProfilingCallCheckContext<IsNotNegativeReturnCheckPolicy, ErrnoErrorPolicy, Tag>;
+
+template <class Tag>
+const CallSiteStats *statsOf(const TraceSnapshot &snapshot) {
+    return snapshot.find(&_auxiliary::TypeKey<Tag>::key);
+}
+
+template <class Tag>
+const PerfCounts *perfOf(const PerfSnapshot &snapshot) {
+    return snapshot.find(&_auxiliary::TypeKey<Tag>::key);
+}
+
+int busy(int n) {
+    volatile int sum{0};
+    for (int i = 0; i < n; i++) {
+        sum += i;
+    }
+    return sum >= 0 ? 0 : 1;
+}
+
+}  // namespace
+
+TEST(ProfilingCallCheckContextTest, testRecordsCallsAndLatency) {
+    for (int i = 0; i < 10; i++) {
+        ASSERT_EQ(ct<BusyTag>::callChecked(busy, 100000), 0);
+    }
+    const auto snapshot = TraceRegistry::instance().snapshot();
+    const auto *stats = statsOf<BusyTag>(snapshot);
+    ASSERT_NE(stats, nullptr);
+    ASSERT_EQ(stats->successes, 10u);
+    ASSERT_EQ(stats->latency.count(), 10u);
+    const auto *perf = perfOf<BusyTag>(perfSnapshot());
+    ASSERT_NE(perf, nullptr);
+    ASSERT_EQ(perf->calls, 10u);
+}
+
+TEST(ProfilingCallCheckContextTest, testUnavailableCountersAreZero) {
+    ct<BusyTag>::callChecked(busy, 1000);
+    const auto snapshot = perfSnapshot();
+    const auto &perf = *perfOf<BusyTag>(snapshot);
+    ASSERT_EQ(perf.availableMask, _auxiliary::PerfEventGroup::local().availableMask());
+    for (const auto counter : {PerfCounter::CYCLES, PerfCounter::INSTRUCTIONS,
+                               PerfCounter::CACHE_MISSES, PerfCounter::BRANCH_MISSES,
+                               PerfCounter::TASK_CLOCK}) {
+        if (!perf.available(counter)) {
+            ASSERT_EQ(perf[counter], 0u);
+        }
+    }
+}
+
+TEST(ProfilingCallCheckContextTest, testCountsWork) {
+    const auto availableMask = _auxiliary::PerfEventGroup::local().availableMask();
+    if (availableMask == 0) {
+        GTEST_SKIP() << "perf_event_open is not permitted";
+    }
+    for (int i = 0; i < 10; i++) {
+        ct<BusyTag>::callChecked(busy, 1000000);
+    }
+    const auto snapshot = perfSnapshot();
+    const auto &perf = *perfOf<BusyTag>(snapshot);
+    if (perf.available(PerfCounter::TASK_CLOCK)) {
+        ASSERT_GT(perf[PerfCounter::TASK_CLOCK], 0u);
+    }
+    if (perf.available(PerfCounter::INSTRUCTIONS)) {
+        ASSERT_GT(perf.perCall(PerfCounter::INSTRUCTIONS), 1000000.0);
+    }
+}
+
+TEST(ProfilingCallCheckContextTest, testErrnoIsPreserved) {
+    auto failing = []() {
+        errno = EBADF;
+        return -1;
+    };
+    try {
+        ct<FailingTag>::callChecked(failing);
+        FAIL() << "Expected ErrnoError";
+    } catch (const ErrnoError &e) {
+        ASSERT_EQ(e.code(), std::errc::bad_file_descriptor);
+    }
+    const auto snapshot = TraceRegistry::instance().snapshot();
+    ASSERT_EQ(statsOf<FailingTag>(snapshot)->failures, 1u);
+}
+
+TEST(ProfilingCallCheckContextTest, testSucceedsWithErrnoCheck) {
+    using ErrnoCt =
+            ProfilingCallCheckContext<IsErrnoZeroReturnCheckPolicy, ErrnoErrorPolicy, ErrnoTag>;
+    bool threw{false};
+    // a new thread opens its own counters, which fails (setting errno) where perf is restricted
+    std::thread{[&threw]() {
+        try {
+            ErrnoCt::callChecked([]() { return 0; });
+        } catch (const ErrnoError &) {
+            threw = true;
+        }
+    }}.join();
+    ASSERT_FALSE(threw);
+    const auto snapshot = TraceRegistry::instance().snapshot();
+    ASSERT_EQ(statsOf<ErrnoTag>(snapshot)->successes, 1u);
+    // the counters of the exited thread are kept
+    ASSERT_EQ(perfOf<ErrnoTag>(perfSnapshot())->calls, 1u);
+}
+
+TEST(PerfCountsTest, testMerge) {
+    PerfCounts first{{1, 2, 3, 4, 5}, 1, 1u << static_cast<unsigned>(PerfCounter::CYCLES)};
+    const PerfCounts second{{10, 20, 30, 40, 50}, 3,
+                            1u << static_cast<unsigned>(PerfCounter::TASK_CLOCK)};
+    first.merge(second);
+    ASSERT_EQ(first.calls, 4u);
+    ASSERT_EQ(first[PerfCounter::CYCLES], 11u);
+    ASSERT_EQ(first[PerfCounter::TASK_CLOCK], 55u);
+    ASSERT_DOUBLE_EQ(first.perCall(PerfCounter::INSTRUCTIONS), 5.5);
+    ASSERT_TRUE(first.available(PerfCounter::CYCLES));
+    ASSERT_TRUE(first.available(PerfCounter::TASK_CLOCK));
+    ASSERT_FALSE(first.available(PerfCounter::CACHE_MISSES));
+}
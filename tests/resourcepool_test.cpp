@@ -0,0 +1,220 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "resourcepool.hpp"
+
+using namespace ::cppc;
+
+namespace {
+
+/**
+ * Handles are heap-allocated ints. Every pool in these tests has its own id,
+ * so that the tests do not share pools (which are singletons).
+ */
+template <int id>
+struct Counters {
+    static std::atomic<int> created;
+    static std::atomic<int> reset;
+    static std::atomic<int> destroyed;
+};
+
+template <int id>
+std::atomic<int> Counters<id>::created{0};
+template <int id>
+std::atomic<int> Counters<id>::reset{0};
+template <int id>
+std::atomic<int> Counters<id>::destroyed{0};
+
+template <int id>
+struct CreateInt {
+    int *operator()() const {
+        Counters<id>::created++;
+        return new int{0};
+    }
+};
+
+template <int id>
+struct ResetInt {
+    void operator()(int *value) const noexcept {
+        Counters<id>::reset++;
+        *value = 0;
+    }
+};
+
+template <int id>
+struct DestroyInt {
+    void operator()(int *value) const noexcept {
+        Counters<id>::destroyed++;
+        delete value;
+    }
+};
+
+template <int id, std::size_t depotCapacity = 1024, std::size_t cacheSize = 16>
+using IntPool =
+        ResourcePool<int *, CreateInt<id>, ResetInt<id>, DestroyInt<id>, depotCapacity, cacheSize>;
+
+}  // namespace
+
+TEST(ResourcePoolTest, testLeaseReturnsHandleToPool) {
+    using Pool = IntPool<0>;
+    int *handle{nullptr};
+    {
+        auto lease = Pool::instance().acquire();
+        handle = lease.get();
+        *lease.get() = 17;
+    }
+    ASSERT_EQ(Counters<0>::reset, 1);
+    ASSERT_EQ(Counters<0>::destroyed, 0);
+    auto lease = Pool::instance().acquire();
+    ASSERT_EQ(lease.get(), handle);
+    ASSERT_EQ(*lease.get(), 0);
+    ASSERT_EQ(Counters<0>::created, 1);
+
+    const PoolStats stats{Pool::instance().stats()};
+    ASSERT_EQ(stats.misses, 1u);
+    ASSERT_EQ(stats.cacheHits, 1u);
+    ASSERT_EQ(stats.depotHits, 0u);
+    ASSERT_EQ(stats.hits(), 1u);
+}
+
+TEST(ResourcePoolTest, testMovedFromLeaseIsNotReturned) {
+    using Pool = IntPool<1>;
+    {
+        auto lease = Pool::instance().acquire();
+        auto another = std::move(lease);
+        ASSERT_EQ(lease.get(), nullptr);
+    }
+    ASSERT_EQ(Counters<1>::reset, 1);
+}
+
+TEST(ResourcePoolTest, testPrewarm) {
+    using Pool = IntPool<2>;
+    ASSERT_EQ(Pool::instance().prewarm(4), 4u);
+    ASSERT_EQ(Counters<2>::created, 4);
+    ASSERT_EQ(Pool::instance().idle(), 4u);
+    {
+        auto lease = Pool::instance().acquire();
+        ASSERT_EQ(Counters<2>::created, 4);
+    }
+    const PoolStats stats{Pool::instance().stats()};
+    ASSERT_EQ(stats.misses, 0u);
+    ASSERT_EQ(stats.depotHits, 1u);
+}
+
+TEST(ResourcePoolTest, testHighWatermark) {
+    using Pool = IntPool<3, 16, 4>;
+    Pool::instance().setWatermarks(0, 2);
+    {
+        std::vector<Pool::Lease> leases{};
+        for (int i = 0; i < 10; i++) {
+            leases.push_back(Pool::instance().acquire());
+        }
+    }
+    // the cache keeps four handles, the depot two, the rest is destroyed
+    ASSERT_EQ(Pool::instance().idle(), 2u);
+    ASSERT_EQ(Counters<3>::destroyed, 4);
+    ASSERT_EQ(Pool::instance().stats().destroyed, 4u);
+    ASSERT_EQ(Pool::instance().prewarm(10), 0u);
+}
+
+TEST(ResourcePoolTest, testTrim) {
+    using Pool = IntPool<4>;
+    Pool::instance().setWatermarks(2, 1024);
+    ASSERT_EQ(Pool::instance().prewarm(8), 8u);
+    ASSERT_EQ(Pool::instance().trim(), 6u);
+    ASSERT_EQ(Pool::instance().idle(), 2u);
+    ASSERT_EQ(Counters<4>::destroyed, 6);
+    ASSERT_THROW(Pool::instance().setWatermarks(3, 2), std::invalid_argument);
+    ASSERT_THROW(Pool::instance().setWatermarks(0, 1025), std::invalid_argument);
+}
+
+TEST(ResourcePoolTest, testThreadExitReturnsCachedHandles) {
+    using Pool = IntPool<5>;
+    std::thread thread{[]() {
+        auto lease = Pool::instance().acquire();
+        auto another = Pool::instance().acquire();
+    }};
+    thread.join();
+    ASSERT_EQ(Pool::instance().idle(), 2u);
+    ASSERT_EQ(Pool::instance().stats().misses, 2u);
+}
+
+/**
+ * Holds a lease in a thread_local that is constructed before (and hence
+ * destroyed after) the thread's cache.
+ */
+struct LateLease {
+    std::unique_ptr<IntPool<7>::Lease> lease{};
+
+    ~LateLease() {
+        lease.reset();
+        auto another = IntPool<7>::instance().acquire();
+    }
+};
+
+TEST(ResourcePoolTest, testLeaseOutlivesThreadCache) {
+    using Pool = IntPool<7>;
+    std::thread thread{[]() {
+        thread_local LateLease late{};
+        late.lease.reset(new Pool::Lease{Pool::instance().acquire()});
+    }};
+    thread.join();
+    ASSERT_EQ(Pool::instance().idle(), 1u);
+    ASSERT_EQ(Counters<7>::created, 1);
+    ASSERT_EQ(Counters<7>::reset, 2);
+    ASSERT_EQ(Pool::instance().stats().depotHits, 1u);
+}
+
+TEST(ResourcePoolTest, testConcurrentLeases) {
+    using Pool = IntPool<6, 64, 4>;
+    constexpr int numThreads{4};
+    std::atomic<bool> exclusive{true};
+    std::vector<std::thread> threads{};
+    for (int t = 0; t < numThreads; t++) {
+        threads.emplace_back([&exclusive]() {
+            for (int i = 0; i < 2000; i++) {
+                std::vector<Pool::Lease> leases{};
+                for (int j = 0; j < 1 + i % 8; j++) {
+                    leases.push_back(Pool::instance().acquire());
+                    // no other lease holds this handle
+                    exclusive = exclusive && *leases.back().get() == 0;
+                    *leases.back().get() = 1;
+                }
+                std::this_thread::yield();
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    ASSERT_TRUE(exclusive);
+    ASSERT_EQ(Counters<6>::created - Counters<6>::destroyed,
+              static_cast<int>(Pool::instance().idle()));
+    const PoolStats stats{Pool::instance().stats()};
+    ASSERT_EQ(stats.misses, static_cast<std::uint64_t>(Counters<6>::created));
+    ASSERT_EQ(stats.hits() + stats.misses, static_cast<std::uint64_t>(Counters<6>::reset));
+}
+
+static_assert(sizeof(IntPool<0>::Lease) == sizeof(int *),
+              "A lease should be as large as the pooled pointer");
@@ -0,0 +1,138 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+/*
+ * This file is compiled with -fno-exceptions, to make sure that the
+ * non-throwing code paths do not depend on exception support.
+ */
+
+#include <cerrno>
+#include <system_error>
+#include <type_traits>
+
+#include "gtest/gtest.h"
+
+#include "checkcall.hpp"
+#include "result.hpp"
+#include "test_api.h"
+
+using namespace ::cppc;
+using namespace ::cppc::testing::mock;
+using namespace ::cppc::testing::mock::api;
+using namespace ::cppc::testing::assertions;
+
+TEST(ResultTest, testValue) {
+    const Result<int, std::errc> result{17};
+    ASSERT_TRUE(result.ok());
+    ASSERT_TRUE(static_cast<bool>(result));
+    ASSERT_EQ(result.value(), 17);
+    ASSERT_EQ(result.valueOr(0), 17);
+}
+
+TEST(ResultTest, testError) {
+    const Result<int, std::errc> result{fail(std::errc::invalid_argument)};
+    ASSERT_FALSE(result.ok());
+    ASSERT_FALSE(static_cast<bool>(result));
+    ASSERT_EQ(result.error(), std::errc::invalid_argument);
+    ASSERT_EQ(result.valueOr(-1), -1);
+    ASSERT_EQ(result.errorCode(), std::make_error_code(std::errc::invalid_argument));
+    ASSERT_EQ(&result.errorCode().category(), &std::generic_category());
+}
+
+TEST(ResultTest, testErrorCode) {
+    const std::error_code ec{EINVAL, std::system_category()};
+    const Result<int *> result{fail(ec)};
+    ASSERT_FALSE(result.ok());
+    ASSERT_EQ(result.errorCode(), ec);
+}
+
+class ExpectedErrorPolicyTest : public ::testing::Test {
+public:
+    void SetUp() override { MockAPI::instance().reset(); }
+};
+
+TEST_F(ExpectedErrorPolicyTest, testSuccess) {
+    const auto result = callChecked<IsNotNegativeReturnCheckPolicy, ExpectedErrorPolicy<>>(
+            some_func_with_error_code, 17);
+    ASSERT_CALLED(MockAPI::instance().someFuncWithErrorCode());
+    ASSERT_TRUE(result.ok());
+    ASSERT_EQ(result.value(), 17);
+    static_assert(std::is_same<std::decay_t<decltype(result)>, Result<int, std::errc>>::value,
+                  "Should return a Result of the return value type");
+}
+
+TEST_F(ExpectedErrorPolicyTest, testErrnoErrorSource) {
+    auto func = [](int x) {
+        errno = EAGAIN;
+        return x;
+    };
+    using ct = CallCheckContext<IsNotNegativeReturnCheckPolicy, ExpectedErrorPolicy<>>;
+    const auto result = ct::callChecked(func, -1);
+    ASSERT_FALSE(result.ok());
+    ASSERT_EQ(result.error(), std::errc::resource_unavailable_try_again);
+}
+
+TEST_F(ExpectedErrorPolicyTest, testNegatedReturnValueErrorSource) {
+    using ct = CallCheckContext<IsNotNegativeReturnCheckPolicy,
+                                ExpectedErrorPolicy<NegatedReturnValueErrorSource>>;
+    const auto result = ct::callChecked(some_func_with_error_code, -EINVAL);
+    ASSERT_CALLED(MockAPI::instance().someFuncWithErrorCode());
+    ASSERT_FALSE(result.ok());
+    ASSERT_EQ(result.error(), std::errc::invalid_argument);
+}
+
+TEST_F(ExpectedErrorPolicyTest, testWithPreCall) {
+    auto func = [](bool fail) {
+        if (fail) {
+            errno = ENOENT;
+        }
+        return 0;
+    };
+    CallGuard<decltype(func), IsErrnoZeroReturnCheckPolicy, ExpectedErrorPolicy<>> guard{func};
+    errno = EINVAL;  // must be reset by the ReturnCheckPolicy
+    ASSERT_TRUE(guard(false).ok());
+    const auto result = guard(true);
+    ASSERT_FALSE(result.ok());
+    ASSERT_EQ(result.error(), std::errc::no_such_file_or_directory);
+}
+
+TEST_F(ExpectedErrorPolicyTest, testPointerReturnValue) {
+    int value{0};
+    using ct = CallCheckContext<IsNotNullptrReturnCheckPolicy, ExpectedErrorPolicy<>>;
+    ASSERT_EQ(ct::callChecked(c_api_some_func_returning_pointer, &value).value(), &value);
+    errno = ENOMEM;
+    ASSERT_EQ(ct::callChecked(c_api_some_func_returning_pointer, nullptr).error(),
+              std::errc::not_enough_memory);
+}
+
+/*
+ * Static tests.
+ */
+
+static_assert(std::is_trivially_copyable<Result<int, std::errc>>::value,
+              "Result of trivially copyable types should be trivially copyable");
+
+static_assert(std::is_trivially_copyable<Result<int, std::error_code>>::value,
+              "Result of trivially copyable types should be trivially copyable");
+
+static_assert(sizeof(Result<int, std::errc>) <= 2 * sizeof(int),
+              "Result<int, std::errc> should fit into a single register");
+
+static_assert(sizeof(Result<int *, std::errc>) <= 2 * sizeof(int *),
+              "Result<T*, std::errc> should fit into two registers");
+
+static_assert(noexcept(ExpectedErrorPolicy<>::handleError(-1)),
+              "ExpectedErrorPolicy should not throw");
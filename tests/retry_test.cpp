@@ -0,0 +1,149 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#include <cerrno>
+#include <memory>
+
+#include "gtest/gtest.h"
+
+#include "retry.hpp"
+
+using namespace ::cppc;
+
+namespace {
+
+/**
+ * Fails with the given error (in errno) the first `failures` times it is
+ * called, then returns 0. A successful call does not touch errno.
+ */
+struct flaky_func_t {
+    int operator()() {
+        calls++;
+        if (calls <= failures) {
+            errno = error;
+            return -1;
+        }
+        return 0;
+    }
+
+    int failures;
+    int error;
+    int calls{0};
+};
+
+template <class RetryCondition,
+          class ReturnCheckPolicy = IsNotNegativeReturnCheckPolicy,
+          class Backoff = NoBackoff,
+          unsigned maxAttempts = 0>
+using ct = RetryingCallCheckContext<RetryCondition, ReturnCheckPolicy, ErrnoErrorPolicy, Backoff,
+                                    maxAttempts>;
+
+}  // namespace
+
+TEST(RetryTest, testRetriesUntilSuccess) {
+    using retrying = ct<RetryOn<EINTR, EAGAIN>>;
+    retrying::stats().reset();
+    flaky_func_t func{3, EINTR};
+    ASSERT_EQ(retrying::callChecked(func), 0);
+    ASSERT_EQ(func.calls, 4);
+    ASSERT_EQ(retrying::stats().retries(), 3u);
+    ASSERT_EQ(retrying::stats().exhausted(), 0u);
+
+    func = flaky_func_t{2, EAGAIN};
+    ASSERT_EQ(retrying::callChecked(func), 0);
+    ASSERT_EQ(retrying::stats().retries(), 5u);
+}
+
+TEST(RetryTest, testOtherErrorsAreNotRetried) {
+    using retrying = ct<RetryOn<EINTR>>;
+    retrying::stats().reset();
+    flaky_func_t func{3, EBADF};
+    try {
+        retrying::callChecked(func);
+        FAIL() << "Expected ErrnoError";
+    } catch (const ErrnoError &e) {
+        ASSERT_EQ(e.code(), std::errc::bad_file_descriptor);
+    }
+    ASSERT_EQ(func.calls, 1);
+    ASSERT_EQ(retrying::stats().retries(), 0u);
+}
+
+TEST(RetryTest, testMaxAttempts) {
+    using retrying = ct<RetryOn<EINTR>, IsNotNegativeReturnCheckPolicy, NoBackoff, 3>;
+    retrying::stats().reset();
+    flaky_func_t func{5, EINTR};
+    try {
+        retrying::callChecked(func);
+        FAIL() << "Expected ErrnoError";
+    } catch (const ErrnoError &e) {
+        ASSERT_EQ(e.code(), std::errc::interrupted);
+    }
+    ASSERT_EQ(func.calls, 3);
+    ASSERT_EQ(retrying::stats().retries(), 2u);
+    ASSERT_EQ(retrying::stats().exhausted(), 1u);
+
+    func = flaky_func_t{2, EINTR};
+    ASSERT_EQ(retrying::callChecked(func), 0);
+    ASSERT_EQ(retrying::stats().exhausted(), 1u);
+}
+
+TEST(RetryTest, testPreCallOnEveryAttempt) {
+    using retrying = ct<RetryOn<EINTR>, IsErrnoZeroReturnCheckPolicy>;
+    // without preCall, errno would still be EINTR after the successful attempt
+    flaky_func_t func{2, EINTR};
+    ASSERT_EQ(retrying::callChecked(func), 0);
+    ASSERT_EQ(func.calls, 3);
+}
+
+TEST(RetryTest, testNegatedReturnValueErrors) {
+    using retrying = RetryingCallCheckContext<RetryOnErrors<NegatedReturnValueErrorSource, EAGAIN>,
+                                              IsNotNegativeReturnCheckPolicy,
+                                              ExpectedErrorPolicy<NegatedReturnValueErrorSource>>;
+    int calls{0};
+    auto func = [&calls]() { return ++calls < 3 ? -EAGAIN : 17; };
+    const auto result = retrying::callChecked(func);
+    ASSERT_TRUE(result);
+    ASSERT_EQ(result.value(), 17);
+
+    auto failing = []() { return -EIO; };
+    ASSERT_EQ(retrying::callChecked(failing).error(), std::errc::io_error);
+}
+
+TEST(RetryTest, testBackoff) {
+    using spinning = ct<RetryOn<EINTR>, IsNotNegativeReturnCheckPolicy, SpinThenYieldBackoff<2>>;
+    flaky_func_t func{5, EINTR};
+    ASSERT_EQ(spinning::callChecked(func), 0);
+
+    using sleeping = ct<RetryOn<EINTR>, IsNotNegativeReturnCheckPolicy, ExponentialBackoff<1, 4>>;
+    func = flaky_func_t{5, EINTR};
+    ASSERT_EQ(sleeping::callChecked(func), 0);
+    ASSERT_EQ(func.calls, 6);
+}
+
+TEST(RetryTest, testArgumentsAreNotMovedFrom) {
+    using retrying = ct<RetryOn<EINTR>>;
+    int calls{0};
+    auto func = [&calls](std::unique_ptr<int> &ptr) {
+        if (++calls < 3) {
+            errno = EINTR;
+            return -1;
+        }
+        return *ptr;
+    };
+    auto ptr = std::make_unique<int>(17);
+    ASSERT_EQ(retrying::callChecked(func, ptr), 17);
+    ASSERT_NE(ptr, nullptr);
+}
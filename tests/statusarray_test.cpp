@@ -0,0 +1,163 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "checkcall.hpp"
+#include "statusarray.hpp"
+
+using namespace ::cppc;
+
+/**
+ * The checks process the input in SIMD blocks followed by a scalar tail. The
+ * tests therefore use arrays of all lengths up to a few blocks and place
+ * failures at every position.
+ */
+constexpr std::size_t maxLength{70};
+
+template <class T>
+class StatusArrayTest : public ::testing::Test {};
+
+using StatusTypes = ::testing::Types<int, long, std::int64_t, short, unsigned int>;
+TYPED_TEST_SUITE(StatusArrayTest, StatusTypes);
+
+TYPED_TEST(StatusArrayTest, testAllZero) {
+    for (std::size_t length = 0; length <= maxLength; length++) {
+        std::vector<TypeParam> statuses(length, 0);
+        ASSERT_TRUE(AllZeroReturnCheckPolicy::returnValueIsOk(StatusArray<TypeParam>{statuses}));
+        ASSERT_EQ(firstFailureIndex<AllZeroReturnCheckPolicy>(StatusArray<TypeParam>{statuses}),
+                  length);
+        for (std::size_t failure = 0; failure < length; failure++) {
+            statuses[failure] = 1;
+            const StatusArray<TypeParam> array{statuses};
+            ASSERT_FALSE(AllZeroReturnCheckPolicy::returnValueIsOk(array));
+            ASSERT_EQ(firstFailureIndex<AllZeroReturnCheckPolicy>(array), failure);
+            statuses[failure] = 0;
+        }
+    }
+}
+
+TYPED_TEST(StatusArrayTest, testFailingIndices) {
+    std::vector<TypeParam> statuses(maxLength, 0);
+    std::vector<std::size_t> expected{};
+    for (std::size_t i = 0; i < maxLength; i += 7) {
+        statuses[i] = 2;
+        expected.push_back(i);
+    }
+    ASSERT_EQ(failingIndices<AllZeroReturnCheckPolicy>(StatusArray<TypeParam>{statuses}),
+              expected);
+}
+
+template <class T>
+class SignedStatusArrayTest : public ::testing::Test {};
+
+using SignedStatusTypes = ::testing::Types<int, long, std::int64_t, short>;
+TYPED_TEST_SUITE(SignedStatusArrayTest, SignedStatusTypes);
+
+TYPED_TEST(SignedStatusArrayTest, testAllNotNegative) {
+    for (std::size_t length = 0; length <= maxLength; length++) {
+        std::vector<TypeParam> statuses(length);
+        for (std::size_t i = 0; i < length; i++) {
+            statuses[i] = static_cast<TypeParam>(i);
+        }
+        ASSERT_TRUE(AllNotNegativeReturnCheckPolicy::returnValueIsOk(
+                StatusArray<TypeParam>{statuses}));
+        for (std::size_t failure = 0; failure < length; failure++) {
+            statuses[failure] = -1;
+            const StatusArray<TypeParam> array{statuses};
+            ASSERT_FALSE(AllNotNegativeReturnCheckPolicy::returnValueIsOk(array));
+            ASSERT_EQ(firstFailureIndex<AllNotNegativeReturnCheckPolicy>(array), failure);
+            statuses[failure] = static_cast<TypeParam>(failure);
+        }
+    }
+}
+
+#if defined(CPPC_STATUS_ARRAY_SIMD)
+/**
+ * The checks above only use the best implementation the CPU supports, so
+ * compare the others with the scalar loop directly.
+ */
+template <class Check, class T>
+void testSimdImplementations(T failure) {
+    const bool hasAvx2{_auxiliary::simdLevel() == _auxiliary::SimdLevel::AVX2};
+    for (std::size_t length = 0; length <= maxLength; length++) {
+        std::vector<T> statuses(length, 0);
+        for (std::size_t position = 0; position <= length; position++) {
+            if (position < length) {
+                statuses[position] = failure;
+            }
+            for (std::size_t begin = 0; begin <= length; begin += 5) {
+                const std::size_t expected{_auxiliary::firstFailure<Check>(
+                        statuses.data(), begin, length, std::false_type{})};
+                ASSERT_EQ(_auxiliary::firstFailureSse2<Check>(statuses.data(), begin, length),
+                          expected);
+                if (hasAvx2) {
+                    ASSERT_EQ(_auxiliary::firstFailureAvx2<Check>(statuses.data(), begin, length),
+                              expected);
+                }
+            }
+            if (position < length) {
+                statuses[position] = 0;
+            }
+        }
+    }
+}
+
+TEST(StatusArrayTest, testSimdImplementations) {
+    testSimdImplementations<_auxiliary::NonZeroCheck>(std::int32_t{1});
+    testSimdImplementations<_auxiliary::NonZeroCheck>(std::int64_t{1} << 40);
+    testSimdImplementations<_auxiliary::NegativeCheck>(std::int32_t{-1});
+    testSimdImplementations<_auxiliary::NegativeCheck>(std::int64_t{-1});
+}
+#endif
+
+TEST(StatusArrayTest, testFirstFailureIndexFrom) {
+    const std::array<int, 5> statuses{{-1, 0, -1, 0, 0}};
+    ASSERT_EQ(firstFailureIndex<AllNotNegativeReturnCheckPolicy>(statusArray(statuses.data(), 5)),
+              0u);
+    ASSERT_EQ(firstFailureIndex<AllNotNegativeReturnCheckPolicy>(
+                      statusArray(statuses.data(), 5), 1),
+              2u);
+    ASSERT_EQ(firstFailureIndex<AllNotNegativeReturnCheckPolicy>(
+                      statusArray(statuses.data(), 5), 3),
+              5u);
+}
+
+TEST(StatusArrayTest, testCallCheckContext) {
+    using ct = CallCheckContext<AllNotNegativeReturnCheckPolicy,
+                                ReportFailingIndicesErrorPolicy<AllNotNegativeReturnCheckPolicy>>;
+    std::vector<long> results(20, 1);
+    auto receive = [&results]() { return StatusArray<long>{results}; };
+
+    ASSERT_EQ(ct::callChecked(receive).data(), results.data());
+
+    results[3] = -4;
+    results[17] = -11;
+    try {
+        ct::callChecked(receive);
+    } catch (const StatusArrayError &e) {
+        ASSERT_EQ(e.failingIndices(), (std::vector<std::size_t>{3, 17}));
+        ASSERT_EQ(std::string(e.what()), std::string("2 of 20 status codes indicated error"));
+        return;
+    }
+    FAIL() << "Execution should not reach this line";
+}
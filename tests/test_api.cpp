@@ -24,6 +24,13 @@ int c_api_some_func_with_error_code(int x, int *ctx) {
     }
     return x;
 }
+
+int *c_api_some_func_returning_pointer(int *ptr) { return ptr; }
+
+/*
+ * Intentionally a no-op, so that it measures nothing but the cost of the call.
+ */
+void c_api_free_resource(int *) {}
 }
 
 namespace cppc {
@@ -29,6 +29,10 @@ extern "C" {
 
 int c_api_some_func_with_error_code(int code, int *ctx);
 
+int *c_api_some_func_returning_pointer(int *ptr);
+
+void c_api_free_resource(int *ptr);
+
 }
 
 namespace cppc {
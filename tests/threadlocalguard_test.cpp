@@ -0,0 +1,166 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "threadlocalguard.hpp"
+
+using namespace ::cppc;
+
+namespace {
+
+std::atomic<int> created{0};
+std::atomic<int> freed{0};
+std::atomic<bool> failCreate{false};
+
+struct CreateInt {
+    int *operator()() const {
+        if (failCreate) {
+            throw std::runtime_error("cannot create");
+        }
+        return new int{++created};
+    }
+};
+
+struct FreeInt {
+    void operator()(int *value) const noexcept {
+        freed++;
+        delete value;
+    }
+
+    static constexpr int *nullValue() noexcept { return nullptr; }
+};
+
+/**
+ * Every test uses its own instances (tag) and starts with fresh counters.
+ */
+template <int tag>
+using IntPerThread = ThreadLocalGuard<int *, CreateInt, FreeInt, std::integral_constant<int, tag>>;
+
+class ThreadLocalGuardTest : public ::testing::Test {
+public:
+    void SetUp() override {
+        created = 0;
+        freed = 0;
+        failCreate = false;
+    }
+};
+
+/**
+ * Lets threads wait until the test releases them.
+ */
+class Gate {
+public:
+    void open() {
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            _open = true;
+        }
+        _opened.notify_all();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock{_mutex};
+        _opened.wait(lock, [this]() { return _open; });
+    }
+
+private:
+    std::mutex _mutex{};
+    std::condition_variable _opened{};
+    bool _open{false};
+};
+
+}  // namespace
+
+TEST_F(ThreadLocalGuardTest, testCreatesOncePerThread) {
+    using PerThread = IntPerThread<0>;
+    ASSERT_FALSE(PerThread::exists());
+    int *value{PerThread::get()};
+    ASSERT_TRUE(PerThread::exists());
+    ASSERT_EQ(PerThread::get(), value);
+    ASSERT_EQ(created, 1);
+
+    int *other{nullptr};
+    std::thread thread{[&other]() { other = PerThread::get(); }};
+    thread.join();
+    ASSERT_NE(other, value);
+    ASSERT_EQ(created, 2);
+    // freed on thread exit
+    ASSERT_EQ(freed, 1);
+    ASSERT_EQ(PerThread::size(), 1u);
+}
+
+TEST_F(ThreadLocalGuardTest, testForEachAndShutdown) {
+    using PerThread = IntPerThread<1>;
+    constexpr int numThreads{3};
+    Gate allCreated{};
+    Gate done{};
+    std::atomic<int> numCreated{0};
+    std::vector<std::thread> threads{};
+    for (int i = 0; i < numThreads; i++) {
+        threads.emplace_back([&]() {
+            PerThread::get();
+            if (++numCreated == numThreads) {
+                allCreated.open();
+            }
+            done.wait();
+        });
+    }
+    allCreated.wait();
+
+    int sum{0};
+    PerThread::forEach([&sum](int *value) { sum += *value; });
+    ASSERT_EQ(sum, 1 + 2 + 3);
+    ASSERT_EQ(PerThread::size(), 3u);
+
+    ASSERT_EQ(PerThread::shutdown(), 3u);
+    ASSERT_EQ(freed, 3);
+    ASSERT_EQ(PerThread::size(), 0u);
+
+    done.open();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    // not freed again on thread exit
+    ASSERT_EQ(freed, 3);
+}
+
+TEST_F(ThreadLocalGuardTest, testGetAfterShutdownCreatesNewInstance) {
+    using PerThread = IntPerThread<2>;
+    ASSERT_EQ(*PerThread::get(), 1);
+    ASSERT_EQ(PerThread::shutdown(), 1u);
+    ASSERT_FALSE(PerThread::exists());
+    ASSERT_EQ(*PerThread::get(), 2);
+    ASSERT_EQ(freed, 1);
+}
+
+TEST_F(ThreadLocalGuardTest, testFailedCreateIsRetried) {
+    using PerThread = IntPerThread<3>;
+    failCreate = true;
+    ASSERT_THROW(PerThread::get(), std::runtime_error);
+    ASSERT_FALSE(PerThread::exists());
+    ASSERT_EQ(PerThread::size(), 0u);
+    failCreate = false;
+    ASSERT_EQ(*PerThread::get(), 1);
+}
@@ -0,0 +1,70 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+/*
+ * This file is not linked into any test. It is compiled to assembly with
+ * CPPC_NO_TRACING defined, to verify that a TracingCallCheckContext (and a
+ * ProfilingCallCheckContext) then compiles to the same code as a plain
+ * CallCheckContext (see compare_codegen.cmake).
+ */
+
+#include "perfcounters.hpp"
+#include "tracing.hpp"
+
+extern "C" {
+
+int codegen_call(int, const char *);
+
+[[noreturn]] void codegen_fail(int);
+
+struct CodegenErrorPolicy {
+    static void handleError(int rv) { codegen_fail(rv); }
+};
+
+struct CodegenTag {
+    static constexpr const char *name{"codegen_call"};
+};
+
+int cppc_codegen_expected_context_call(int arg, const char *str) {
+    return cppc::CallCheckContext<cppc::IsNotNegativeReturnCheckPolicy,
+                                  CodegenErrorPolicy>::callChecked(codegen_call, arg, str);
+}
+
+int cppc_codegen_actual_context_call(int arg, const char *str) {
+    return cppc::TracingCallCheckContext<cppc::IsNotNegativeReturnCheckPolicy, CodegenErrorPolicy,
+                                         CodegenTag>::callChecked(codegen_call, arg, str);
+}
+
+int cppc_codegen_expected_untagged_call(int arg, const char *str) {
+    return cppc::CallCheckContext<cppc::IsNotNegativeReturnCheckPolicy,
+                                  CodegenErrorPolicy>::callChecked(codegen_call, arg, str);
+}
+
+int cppc_codegen_actual_untagged_call(int arg, const char *str) {
+    return cppc::TracingCallCheckContext<cppc::IsNotNegativeReturnCheckPolicy,
+                                         CodegenErrorPolicy>::callChecked(codegen_call, arg, str);
+}
+
+int cppc_codegen_expected_profiling_call(int arg, const char *str) {
+    return cppc::CallCheckContext<cppc::IsNotNegativeReturnCheckPolicy,
+                                  CodegenErrorPolicy>::callChecked(codegen_call, arg, str);
+}
+
+int cppc_codegen_actual_profiling_call(int arg, const char *str) {
+    return cppc::ProfilingCallCheckContext<cppc::IsNotNegativeReturnCheckPolicy,
+                                           CodegenErrorPolicy>::callChecked(codegen_call, arg, str);
+}
+}
@@ -0,0 +1,172 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "test_api.h"
+#include "tracing.hpp"
+
+using namespace ::cppc;
+using namespace ::cppc::testing::mock::api;
+
+namespace {
+
+struct NamedTag {
+    static constexpr const char *name{"named"};
+};
+
+struct ThreadsTag {};
+
+struct SleepTag {};
+
+template <class Tag>
+using ct = TracingCallCheckContext<IsNotNegativeReturnCheckPolicy, ReportReturnValueErrorPolicy, Tag>;
+
+template <class Tag>
+const void *siteOf() {
+    return &_auxiliary::TypeKey<Tag>::key;
+}
+
+}  // namespace
+
+TEST(LatencyHistogramTest, testBuckets) {
+    const std::vector<std::uint64_t> values{
+            0, 1, 7, 8, 9, 15, 16, 17, 1000, 123456789, std::numeric_limits<std::uint64_t>::max()};
+    for (const auto value : values) {
+        const auto bucket = LatencyHistogram::bucketOf(value);
+        ASSERT_LT(bucket, LatencyHistogram::NUM_BUCKETS);
+        ASSERT_LE(LatencyHistogram::lowerBound(bucket), value);
+        if (bucket + 1 < LatencyHistogram::NUM_BUCKETS) {
+            ASSERT_GT(LatencyHistogram::lowerBound(bucket + 1), value);
+        }
+    }
+    ASSERT_EQ(LatencyHistogram::bucketOf(std::numeric_limits<std::uint64_t>::max()),
+              LatencyHistogram::NUM_BUCKETS - 1);
+    for (std::size_t bucket = 0; bucket < LatencyHistogram::NUM_BUCKETS; bucket++) {
+        ASSERT_EQ(LatencyHistogram::bucketOf(LatencyHistogram::lowerBound(bucket)), bucket);
+    }
+}
+
+TEST(LatencyHistogramTest, testPercentile) {
+    LatencyHistogram histogram{};
+    ASSERT_EQ(histogram.percentile(0.5), 0u);
+    for (std::uint64_t value = 1; value <= 100; value++) {
+        histogram.record(value);
+    }
+    ASSERT_EQ(histogram.count(), 100u);
+    ASSERT_EQ(histogram.percentile(0.0), 1u);
+    ASSERT_EQ(histogram.percentile(0.5), 48u);  // 50 is in [48, 52)
+    ASSERT_EQ(histogram.percentile(1.0), 96u);  // 100 is in [96, 104)
+
+    LatencyHistogram other{};
+    other.record(1000, 100);
+    histogram.merge(other);
+    ASSERT_EQ(histogram.count(), 200u);
+    ASSERT_EQ(histogram.percentile(0.99), LatencyHistogram::lowerBound(
+                                                  LatencyHistogram::bucketOf(1000)));
+}
+
+TEST(TracingCallCheckContextTest, testCountsSuccessesAndFailures) {
+    ASSERT_EQ(ct<NamedTag>::callChecked(c_api_some_func_with_error_code, 17, nullptr), 17);
+    ASSERT_EQ(ct<NamedTag>::callChecked(c_api_some_func_with_error_code, 0, nullptr), 0);
+    ASSERT_THROW(ct<NamedTag>::callChecked(c_api_some_func_with_error_code, -1, nullptr),
+                 ReturnValueError);
+
+    const auto snapshot = TraceRegistry::instance().snapshot();
+    const auto *stats = snapshot.find(siteOf<NamedTag>());
+    ASSERT_NE(stats, nullptr);
+    ASSERT_EQ(std::string{stats->name}, "named");
+    ASSERT_EQ(stats->successes, 2u);
+    ASSERT_EQ(stats->failures, 1u);
+    ASSERT_EQ(stats->latency.count(), 3u);
+}
+
+static int traced_func(int x) { return x; }
+
+TEST(TracingCallCheckContextTest, testFunctionIsCallSite) {
+    using untagged = ct<void>;
+    untagged::callChecked(traced_func, 1);
+    untagged::callChecked(&traced_func, 2);
+    auto lambda = [](int x) { return x; };
+    untagged::callChecked(lambda, 3);
+
+    const auto snapshot = TraceRegistry::instance().snapshot();
+    const auto *stats = snapshot.find(reinterpret_cast<const void *>(&traced_func));
+    ASSERT_NE(stats, nullptr);
+    ASSERT_EQ(stats->name, nullptr);
+    ASSERT_EQ(stats->successes, 2u);
+    const auto *lambdaStats = snapshot.find(siteOf<decltype(lambda)>());
+    ASSERT_NE(lambdaStats, nullptr);
+    ASSERT_EQ(lambdaStats->successes, 1u);
+}
+
+TEST(TracingCallCheckContextTest, testSumsOverThreads) {
+    constexpr int numThreads{4};
+    constexpr int numCalls{100};
+    std::vector<std::thread> threads{};
+    for (int t = 0; t < numThreads; t++) {
+        threads.emplace_back([]() {
+            for (int i = 0; i < numCalls; i++) {
+                ct<ThreadsTag>::callChecked(traced_func, i);
+            }
+        });
+    }
+    ct<ThreadsTag>::callChecked(traced_func, 0);
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    const auto snapshot = TraceRegistry::instance().snapshot();
+    ASSERT_EQ(snapshot.find(siteOf<ThreadsTag>())->successes, numThreads * numCalls + 1u);
+}
+
+TEST(TracingCallCheckContextTest, testRecordsLatency) {
+    ct<SleepTag>::callChecked([]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds{2});
+        return 0;
+    });
+    const auto snapshot = TraceRegistry::instance().snapshot();
+    ASSERT_GE(snapshot.find(siteOf<SleepTag>())->latency.percentile(0.5), 1750000u);
+}
+
+TEST(TraceSnapshotTest, testMerge) {
+    TraceSnapshot first{};
+    CallSiteStats stats{&first, nullptr, {}, 1, 2};
+    stats.latency.record(10);
+    first.merge(stats);
+
+    TraceSnapshot second{};
+    stats.name = "name";
+    second.merge(stats);
+    CallSiteStats other{&second, nullptr, {}, 5, 0};
+    second.merge(other);
+
+    first.merge(second);
+    ASSERT_EQ(first.sites().size(), 2u);
+    const auto *merged = first.find(&first);
+    ASSERT_EQ(merged->successes, 2u);
+    ASSERT_EQ(merged->failures, 4u);
+    ASSERT_EQ(merged->latency.count(), 2u);
+    ASSERT_EQ(std::string{merged->name}, "name");
+    ASSERT_EQ(first.find(&second)->successes, 5u);
+}
@@ -0,0 +1,156 @@
+/*   Copyright 2016-2019 Marcus Gelderie
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#include <cerrno>
+#include <cstdlib>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "uring.hpp"
+
+using namespace ::cppc;
+
+using IoBackend = IoUring::IoBackend;
+
+class IoUringTest : public ::testing::TestWithParam<IoBackend> {
+public:
+    void SetUp() override {
+        char path[] = "/tmp/cppc_uring_test_XXXXXX";
+        _fd = mkstemp(path);
+        ASSERT_GE(_fd, 0);
+        _path = path;
+    }
+
+    void TearDown() override {
+        ::close(_fd);
+        ::unlink(_path.c_str());
+    }
+
+protected:
+    static bool isOpen(int fd) { return fcntl(fd, F_GETFD) != -1 || errno != EBADF; }
+
+    int _fd{-1};
+    std::string _path{};
+};
+
+TEST_P(IoUringTest, testWriteAndRead) {
+    IoUring ring{8, GetParam()};
+    const std::string data{"some data"};
+    ASSERT_EQ(ring.result(ring.write(_fd, data.data(), data.size(), 0)), 9);
+
+    char buffer[16]{};
+    const auto first = ring.read(_fd, buffer, 4, 0);
+    const auto second = ring.read(_fd, buffer + 4, 5, 4);
+    ASSERT_EQ(ring.result(second), 5);
+    ASSERT_EQ(ring.result(first), 4);
+    ASSERT_EQ(std::string{buffer}, data);
+}
+
+TEST_P(IoUringTest, testReadFromCurrentPosition) {
+    IoUring ring{8, GetParam()};
+    ASSERT_EQ(ring.result(ring.write(_fd, "abcdef", 6)), 6);
+    ASSERT_EQ(lseek(_fd, 2, SEEK_SET), 2);
+
+    char buffer[8]{};
+    ASSERT_EQ(ring.result(ring.read(_fd, buffer, sizeof(buffer))), 4);
+    ASSERT_EQ(std::string{buffer}, "cdef");
+}
+
+TEST_P(IoUringTest, testMoreOperationsThanEntries) {
+    IoUring ring{4, GetParam()};
+    constexpr int numWrites{100};
+    std::vector<IoTicket> tickets{};
+    for (int i = 0; i < numWrites; i++) {
+        tickets.push_back(ring.write(_fd, "x", 1, i));
+    }
+    for (const auto ticket : tickets) {
+        ASSERT_EQ(ring.result(ticket), 1);
+    }
+    ASSERT_EQ(lseek(_fd, 0, SEEK_END), numWrites);
+}
+
+TEST_P(IoUringTest, testErrorIsReported) {
+    IoUring ring{8, GetParam()};
+    try {
+        ring.result(ring.openat(AT_FDCWD, "/nonexistent/cppc", O_RDONLY));
+        FAIL() << "Expected ErrnoError";
+    } catch (const ErrnoError &e) {
+        ASSERT_EQ(e.code(), std::errc::no_such_file_or_directory);
+    }
+    char buffer[1];
+    ASSERT_THROW(ring.result(ring.read(-1, buffer, sizeof(buffer))), ErrnoError);
+}
+
+TEST_P(IoUringTest, testExpectedErrorPolicy) {
+    IoUring ring{8, GetParam()};
+    const auto result = ring.result<ExpectedErrorPolicy<NegatedReturnValueErrorSource>>(
+            ring.openat(AT_FDCWD, "/nonexistent/cppc", O_RDONLY));
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), std::errc::no_such_file_or_directory);
+}
+
+TEST_P(IoUringTest, testGuardClosesThroughRing) {
+    int fd{-1};
+    {
+        IoUring ring{8, GetParam()};
+        {
+            UringFdGuard guard{ring.open(AT_FDCWD, _path.c_str(), O_RDONLY)};
+            fd = guard.get();
+            ASSERT_TRUE(isOpen(fd));
+        }
+        ring.submit();
+    }
+    ASSERT_FALSE(isOpen(fd));
+}
+
+TEST_P(IoUringTest, testClosesAreBatched) {
+    std::vector<int> fds{};
+    {
+        IoUring ring{8, GetParam()};
+        {
+            std::vector<UringFdGuard> guards{};
+            for (int i = 0; i < 3; i++) {
+                guards.push_back(ring.open(AT_FDCWD, _path.c_str(), O_RDONLY));
+                fds.push_back(guards.back().get());
+            }
+        }
+        if (!ring.usesSyscalls()) {
+            for (const int fd : fds) {
+                ASSERT_TRUE(isOpen(fd));
+            }
+            ASSERT_EQ(ring.submit(), 3u);
+        }
+    }
+    for (const int fd : fds) {
+        ASSERT_FALSE(isOpen(fd));
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(Backends,
+                         IoUringTest,
+                         ::testing::Values(IoBackend::AUTO, IoBackend::SYSCALLS));
+
+TEST(IoUringBackendTest, testSyscallsBackend) {
+    IoUring ring{8, IoBackend::SYSCALLS};
+    ASSERT_TRUE(ring.usesSyscalls());
+    ASSERT_EQ(ring.submit(), 0u);
+}